@@ -0,0 +1,357 @@
+#include "raylib.h"
+
+#include <stdbool.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "shared.h"
+#include "midi.h"
+#include "wav.h"
+#include "ui.h"
+#include "synth.h"
+#include "notes.h"
+#include "peaks.h"
+#include "buffer.h"
+
+#define SONG_NOTES_COUNT  10000
+#define SONG_NOTE_SPACING 2 // ticks
+
+// micro-benchmarks of the hot paths
+// every benchmark runs warmup iterations first, then times every iteration on its own
+// one json object per line goes to stdout so runs of different commits can be compared, progress goes to stderr
+
+typedef void (*BenchFunction)(void *context);
+
+static double now_nanoseconds(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double value1 = *(const double *)a;
+    double value2 = *(const double *)b;
+    if (value1 != value2)  return value1 < value2 ? -1 : 1;
+    return 0;
+}
+
+static void run_benchmark(const char *name, const char *parameter_name, int parameter,
+                          int warmup_count, int iterations_count, BenchFunction function, void *context) {
+    for (int i = 0; i < warmup_count; i++)  function(context);
+
+    double *times = malloc(sizeof(double) * iterations_count);
+    assert(times != NULL && "Buy more RAM lol");
+
+    double total = 0;
+    for (int i = 0; i < iterations_count; i++) {
+        double start = now_nanoseconds();
+        function(context);
+        times[i] = now_nanoseconds() - start;
+        total += times[i];
+    }
+    qsort(times, iterations_count, sizeof(double), compare_doubles);
+
+    double median = times[iterations_count / 2];
+    double p99 = times[(int) ceil(iterations_count * 0.99) - 1];
+
+    printf("{\"benchmark\": \"%s\", \"parameter\": \"%s\", \"value\": %d, \"iterations\": %d, "
+           "\"min_ns\": %.0f, \"median_ns\": %.0f, \"p99_ns\": %.0f, \"mean_ns\": %.0f}\n",
+           name, parameter_name, parameter, iterations_count, times[0], median, p99, total / iterations_count);
+    fflush(stdout);
+    fprintf(stderr, "%-22s %-10s %8d  median %12.0f ns  p99 %12.0f ns\n", name, parameter_name, parameter, median, p99);
+    free(times);
+}
+
+// SYNTH
+
+typedef struct {
+    NoteStore notes;
+    SoundState data;
+    float buffer[FRAMES_PER_BUFFER * NUMBER_OF_CHANNELS];
+} SynthBench;
+
+static void bench_synth_block(void *context) {
+    SynthBench *bench = context;
+    bool success = create_samples_from_notes(bench->buffer, &bench->data, FRAMES_PER_BUFFER, FRAMES_PER_TICK);
+    assert(success);
+}
+
+// every note starts at tick 0 and holds for the whole benchmark, so every block mixes polyphony voices
+static void run_synth_benchmarks(void) {
+    int polyphonies[] = { 1, 8, MAX_POLYPHONY, 128, VOICES_CAPACITY };
+
+    for (int p = 0; p < (int)(sizeof(polyphonies) / sizeof(*polyphonies)); p++) {
+        int polyphony = polyphonies[p];
+        SynthBench *bench = calloc(1, sizeof(SynthBench));
+        assert(bench != NULL && "Buy more RAM lol");
+
+        for (int i = 0; i < polyphony; i++) {
+            add_note(&bench->notes, (Note) { .key = 30 + i % 70, .velocity = 100, .start_tick = 0, .end_tick = UINT32_MAX / FRAMES_PER_TICK });
+        }
+        bench->data = (SoundState) { .notes = &bench->notes, .waveform = WAVEFORM_SAW };
+        init_voice_allocator(&bench->data.allocator, STEAL_NONE, polyphony > MAX_POLYPHONY);
+        create_sound_events(&bench->data);
+
+        run_benchmark("synth_block", "polyphony", polyphony, 100, 2000, bench_synth_block, bench);
+
+        free_sound_events(&bench->data);
+        free_note_store(&bench->notes);
+        free(bench);
+    }
+}
+
+// EVENTS AND MIDI
+
+typedef struct {
+    NoteStore notes;
+    uint32_t *ticks;
+    int ticks_count;
+    MidiBuffer data;
+} EventsBench;
+
+static void bench_event_sort(void *context) {
+    EventsBench *bench = context;
+    SoundState data = { .notes = &bench->notes };
+    create_sound_events(&data);
+    free_sound_events(&data);
+}
+
+static void bench_midi_events(void *context) {
+    EventsBench *bench = context;
+    int size;
+    free(create_midi_data(&bench->notes, 1, &size));
+}
+
+static void bench_midi_tracks(void *context) {
+    EventsBench *bench = context;
+    int size;
+    free(create_midi_data(&bench->notes, render_threads_count(), &size));
+}
+
+static void bench_delta_time(void *context) {
+    EventsBench *bench = context;
+    bench->data.size = 0;
+    for (int i = 0; i < bench->ticks_count; i++) {
+        append_delta_time(&bench->data, bench->ticks[i]);
+    }
+}
+
+static void run_events_benchmarks(void) {
+    int notes_counts[] = { 1000, 10000, 100000 };
+
+    for (int n = 0; n < (int)(sizeof(notes_counts) / sizeof(*notes_counts)); n++) {
+        int notes_count = notes_counts[n];
+        EventsBench bench = { 0 };
+        generate_notes(&bench.notes, 1, notes_count);
+
+        // deltas of 1 to 4 bytes
+        bench.ticks_count = notes_count * 2;
+        bench.ticks = malloc(sizeof(uint32_t) * bench.ticks_count);
+        assert(bench.ticks != NULL && "Buy more RAM lol");
+        reserve_midi_buffer(&bench.data, bench.ticks_count * 5);
+        srand(1);
+        for (int i = 0; i < bench.ticks_count; i++) {
+            bench.ticks[i] = rand() % (1u << (7 * (1 + i % 4)));
+        }
+
+        run_benchmark("event_sort", "notes", notes_count, 3, 50, bench_event_sort, &bench);
+        run_benchmark("midi_events", "notes", notes_count, 3, 50, bench_midi_events, &bench);
+        run_benchmark("midi_tracks_threaded", "notes", notes_count, 3, 50, bench_midi_tracks, &bench);
+        run_benchmark("midi_delta_time", "values", bench.ticks_count, 3, 50, bench_delta_time, &bench);
+
+        free(bench.ticks);
+        free_midi_buffer(&bench.data);
+        free_note_store(&bench.notes);
+    }
+}
+
+// RENDER AND WAV
+
+typedef struct {
+    NoteStore notes;
+    SampleBuffer samples;
+    uint32_t frames_count;
+    int threads_count;
+    WaveformPeaks peaks;
+    RenderTexture2D target;
+    float sample_width;
+    int skipping_frames;
+} SongBench;
+
+static void bench_render(void *context) {
+    SongBench *bench = context;
+    SoundState data = { .notes = &bench->notes };
+    init_voice_allocator(&data.allocator, STEAL_RELEASING_FIRST, false);
+    create_sound_events(&data);
+    bool success = render_samples(bench->samples.samples, bench->frames_count, &data, bench->threads_count);
+    assert(success);
+    free_sound_events(&data);
+}
+
+// the writer itself, save_notes_wave_file would report to stdout
+static void write_bench_wav(SongBench *bench, WavFormat format) {
+    WavWriter writer;
+    bool success = open_wav_writer(&writer, "build/bench.wav", format);
+    assert(success && "build/bench.wav can't be opened, run the bench from the repository");
+    write_wav_frames(&writer, bench->samples.samples, bench->frames_count);
+    success = close_wav_writer(&writer);
+    assert(success);
+}
+
+static void bench_wav(void *context) {
+    write_bench_wav(context, WAV_FLOAT32);
+}
+
+static void bench_wav_pcm16(void *context) {
+    write_bench_wav(context, WAV_PCM16);
+}
+
+// DrawWaveform's zoomed out columns into an offscreen target, the whole target is covered
+static void bench_waveform_peaks(void *context) {
+    SongBench *bench = context;
+    Rectangle view = { 0, 0, bench->target.texture.width, bench->target.texture.height };
+    BeginTextureMode(bench->target);
+    ClearBackground(GRAY);
+    DrawWaveformPeaks(&bench->peaks, bench->samples.samples, bench->frames_count, view, view, 0,
+                      bench->sample_width, bench->skipping_frames, 100, true);
+    EndTextureMode();
+}
+
+// a note starts every SONG_NOTE_SPACING ticks and holds for 12 to 20 spacings, so ~16 voices always play
+// (the generated melody plays one note at a time, it would only measure thread overhead)
+static void create_song_notes(NoteStore *notes) {
+    srand(1);
+    for (int i = 0; i < SONG_NOTES_COUNT; i++) {
+        uint32_t start_tick = i * SONG_NOTE_SPACING;
+        add_note(notes, (Note) {
+            .key = 30 + rand() % 60,
+            .velocity = 60 + rand() % 60,
+            .start_tick = start_tick,
+            .end_tick = start_tick + SONG_NOTE_SPACING * (12 + rand() % 9)
+        });
+    }
+}
+
+static void run_song_benchmarks(void) {
+    SongBench bench = { 0 };
+    create_song_notes(&bench.notes);
+    uint32_t end_tick = 0;
+    for (int i = 0; i < bench.notes.notes_count; i++) {
+        end_tick = fmax(end_tick, note_at(&bench.notes, i)->end_tick);
+    }
+    bench.frames_count = song_frames_count(end_tick);
+    resize_sample_buffer(&bench.samples, (size_t) bench.frames_count * NUMBER_OF_CHANNELS);
+
+    // render thread scaling, the last one renders the song for the wav and waveform benchmarks
+    for (int threads_count = 1; ; threads_count *= 2) {
+        bench.threads_count = fmin(threads_count, render_threads_count());
+        run_benchmark("render_song", "threads", bench.threads_count, 1, 3, bench_render, &bench);
+        if (bench.threads_count == render_threads_count())  break;
+    }
+
+    run_benchmark("save_wav", "frames", bench.frames_count, 1, 10, bench_wav, &bench);
+    run_benchmark("save_wav_pcm16", "frames", bench.frames_count, 1, 10, bench_wav_pcm16, &bench);
+
+    SetTraceLogLevel(LOG_WARNING);
+    SetConfigFlags(FLAG_WINDOW_HIDDEN);
+    InitWindow(640, 360, "miseq bench");
+    if (!IsWindowReady()) {
+        fprintf(stderr, "waveform_peaks skipped: no window could be made\n");
+    } else {
+        build_waveform_peaks(&bench.peaks, bench.samples.samples, bench.frames_count);
+        bench.target = LoadRenderTexture(1920, 400);
+
+        // sample widths of the zoomed out waveform, the first one is the furthest zoom
+        // columns are as wide as DrawWaveform makes them: from 4 pixels at 0.01 down to 2 at the zoomed in threshold
+        float sample_widths[] = { 0.0003, 0.005, 0.05 };
+        for (int i = 0; i < (int)(sizeof(sample_widths) / sizeof(*sample_widths)); i++) {
+            bench.sample_width = sample_widths[i];
+            float sample_width_percent = (bench.sample_width - 0.01) / (0.1515 - 0.01);
+            bench.skipping_frames = fmax(1, (4 - 2 * sample_width_percent) / bench.sample_width);
+
+            float column_width = bench.sample_width * bench.skipping_frames;
+            int columns_count = fmin(bench.frames_count * bench.sample_width, bench.target.texture.width) / column_width;
+            run_benchmark("waveform_peaks", "columns", columns_count, 10, 200, bench_waveform_peaks, &bench);
+        }
+
+        UnloadRenderTexture(bench.target);
+        free_waveform_peaks(&bench.peaks);
+        CloseWindow();
+    }
+
+    free_sample_buffer(&bench.samples);
+    free_note_store(&bench.notes);
+}
+
+// NOTE INDEX
+
+typedef struct {
+    NoteStore notes;
+    NoteIndex index;
+    uint32_t view_ticks;
+    uint32_t scroll_tick;
+    int visible_count;
+} NoteIndexBench;
+
+static void bench_note_index_build(void *context) {
+    NoteIndexBench *bench = context;
+    build_note_index(&bench->index, &bench->notes);
+}
+
+// what DrawNotes does every frame short of drawing: find the candidates of the view and check them one by one,
+// the view scrolls a bit every frame
+static void bench_visible_notes(void *context) {
+    NoteIndexBench *bench = context;
+    bench->scroll_tick = (bench->scroll_tick + bench->view_ticks / 8) % bench->index.end_tick;
+    uint32_t end_tick = bench->scroll_tick + bench->view_ticks;
+
+    const int *carried_notes;
+    int carried_count, first_note, last_note;
+    find_notes_in_ticks(&bench->index, &bench->notes, bench->scroll_tick, end_tick,
+                        &carried_notes, &carried_count, &first_note, &last_note);
+
+    int visible_count = 0;
+    int candidates_count = carried_count + last_note - first_note;
+    for (int candidate = 0; candidate < candidates_count; candidate++) {
+        int i = candidate < carried_count ? carried_notes[candidate] : first_note + candidate - carried_count;
+        Note *note = note_at(&bench->notes, i);
+        if (!note->is_deleted && note->start_tick < end_tick && note->end_tick > bench->scroll_tick)  visible_count++;
+    }
+    bench->visible_count = visible_count;
+}
+
+// the polyphonic song under a pedal note held from the first tick to the last,
+// a long early note must not make every frame check every note
+static void run_note_index_benchmarks(void) {
+    NoteIndexBench bench = { 0 };
+    add_note(&bench.notes, (Note) { .key = 24, .velocity = 80, .start_tick = 0, .end_tick = SONG_NOTES_COUNT * SONG_NOTE_SPACING });
+    create_song_notes(&bench.notes);
+
+    run_benchmark("note_index_build", "notes", bench.notes.notes_count, 10, 200, bench_note_index_build, &bench);
+
+    // about a zoomed in and a zoomed out 1920 pixel view
+    uint32_t view_ticks[] = { 1024, 8192 };
+    for (int i = 0; i < (int)(sizeof(view_ticks) / sizeof(*view_ticks)); i++) {
+        bench.view_ticks = view_ticks[i];
+        run_benchmark("visible_notes", "view_ticks", bench.view_ticks, 100, 10000, bench_visible_notes, &bench);
+    }
+
+    free_note_index(&bench.index);
+    free_note_store(&bench.notes);
+}
+
+int main(void) {
+    init_voices();
+    fprintf(stderr, "mix kernel: %s, render threads: %d\n", mix_voices_kernel_name(), render_threads_count());
+
+    run_synth_benchmarks();
+    run_events_benchmarks();
+    run_song_benchmarks();
+    run_note_index_benchmarks();
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include <stdbool.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "buffer.h"
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+static size_t page_size(void) {
+    static size_t size = 0;
+    if (size == 0)  size = sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+// byte offset of sample index rounded up to a whole page
+static size_t page_offset(size_t index) {
+    size_t bytes = index * sizeof(float);
+    return (bytes + page_size() - 1) / page_size() * page_size();
+}
+
+static float *reserve_samples(size_t capacity) {
+    void *region = mmap(NULL, capacity * sizeof(float), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    assert(region != MAP_FAILED && "Buy more RAM lol");
+    return region;
+}
+
+void resize_sample_buffer(SampleBuffer *buffer, size_t count) {
+    if (buffer->samples == NULL) {
+        buffer->capacity = SAMPLE_BUFFER_RESERVED_SAMPLES;
+        while (buffer->capacity < count)  buffer->capacity *= 2;
+        buffer->samples = reserve_samples(buffer->capacity);
+        buffer->count = 0;
+    }
+
+    if (count > buffer->capacity) {
+        size_t capacity = buffer->capacity;
+        while (capacity < count)  capacity *= 2;
+
+        // only pages holding samples get copied, the rest of the new region stays uncommitted
+        float *samples = reserve_samples(capacity);
+        memcpy(samples, buffer->samples, buffer->count * sizeof(float));
+        munmap(buffer->samples, buffer->capacity * sizeof(float));
+        buffer->samples = samples;
+        buffer->capacity = capacity;
+    }
+
+    if (count < buffer->count) {
+        size_t start = page_offset(count);
+        size_t end = page_offset(buffer->count);
+        if (end > start)  madvise((char *) buffer->samples + start, end - start, MADV_DONTNEED);
+    }
+
+    buffer->count = count;
+}
+
+void free_sample_buffer(SampleBuffer *buffer) {
+    if (buffer->samples != NULL)  munmap(buffer->samples, buffer->capacity * sizeof(float));
+    *buffer = (SampleBuffer) { 0 };
+}
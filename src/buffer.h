@@ -0,0 +1,20 @@
+#ifndef BUFFER_INCLUDES
+#define BUFFER_INCLUDES
+
+#include <stddef.h>
+
+#define SAMPLE_BUFFER_RESERVED_SAMPLES ((size_t) 1 << 28) // 1 GB of address space, ~50 minutes of stereo
+
+// samples in a reserved but lazily committed virtual region: memory is only used by pages that were written,
+// the region moves to a bigger reservation when it's outgrown, so pointers into it are only valid until resize
+typedef struct {
+    float *samples;
+    size_t count;
+    size_t capacity; // reserved samples
+} SampleBuffer;
+
+// makes room for count samples keeping the ones that were there, pages past count are given back to the system
+void resize_sample_buffer(SampleBuffer *buffer, size_t count);
+void free_sample_buffer(SampleBuffer *buffer);
+
+#endif // BUFFER_INCLUDES
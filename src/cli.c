@@ -0,0 +1,299 @@
+#include <stdbool.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+#include "shared.h"
+#include "midi.h"
+#include "wav.h"
+#include "synth.h"
+#include "notes.h"
+#include "buffer.h"
+#include "meter.h"
+
+#define WAV_EXPORT_BLOCK_FRAMES 4096
+
+// headless render: generates notes (or reads them from a midi file), renders them like create_waveform_samples does and writes wav/midi
+// without a window or an audio device, then reports how fast the render was
+
+typedef struct {
+    unsigned int seed;
+    int notes_count;
+    int threads_count;
+    Waveform waveform;
+    StealPolicy steal_policy;
+    bool is_voice_pool_growable;
+    bool is_streaming;
+    bool should_skip_render;
+    int buffer_frames;
+    char *wav_path;
+    WavFormat wav_format;
+    char *midi_path;
+    char *midi_input_path;
+} Options;
+
+static double now_seconds(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static void print_usage(const char *program) {
+    printf("usage: %s [options]\n", program);
+    printf("  --seed N          generator seed (default: current time)\n");
+    printf("  --notes N         notes to generate (default: %d)\n", GENERATED_NOTES_COUNT);
+    printf("  --midi-in PATH    read the notes from a midi file instead of generating them\n");
+    printf("  --threads N       render threads (default: one per cpu)\n");
+    printf("  --waveform NAME   sine, saw, square or triangle\n");
+    printf("  --steal NAME      voice stealing policy, see the Steal button\n");
+    printf("  --grow            let the voice pool grow before stealing\n");
+    printf("  --stream          also render block by block like streaming playback and report the dsp load\n");
+    printf("  --buffer N        frames per streamed block (default: %d)\n", FRAMES_PER_BUFFER);
+    printf("  --skip-render     no timed render into memory, with --wav the song is only rendered into the file\n");
+    printf("  --wav PATH        render the song block by block into a wav file\n");
+    printf("  --wav-format NAME f32, 16 or 24 (bit pcm with dither)\n");
+    printf("  --midi PATH       write the notes to a midi file\n");
+}
+
+static bool parse_options(int argc, char **argv, Options *options) {
+    for (int i = 1; i < argc; i++) {
+        char *argument = argv[i];
+        char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        bool has_value = true;
+
+        if (strcmp(argument, "--grow") == 0) {
+            options->is_voice_pool_growable = true;
+            has_value = false;
+        } else if (strcmp(argument, "--stream") == 0) {
+            options->is_streaming = true;
+            has_value = false;
+        } else if (strcmp(argument, "--skip-render") == 0) {
+            options->should_skip_render = true;
+            has_value = false;
+        } else if (value == NULL) {
+            printf("Unknown option or missing value: %s\n", argument);
+            return false;
+        } else if (strcmp(argument, "--seed") == 0) {
+            options->seed = strtoul(value, NULL, 10);
+        } else if (strcmp(argument, "--notes") == 0) {
+            options->notes_count = atoi(value);
+        } else if (strcmp(argument, "--buffer") == 0) {
+            options->buffer_frames = atoi(value);
+        } else if (strcmp(argument, "--threads") == 0) {
+            options->threads_count = atoi(value);
+        } else if (strcmp(argument, "--waveform") == 0) {
+            int waveform = 0;
+            while (waveform < WAVEFORMS_COUNT && strcmp(value, waveform_name(waveform)) != 0)  waveform++;
+            if (waveform == WAVEFORMS_COUNT) {
+                printf("Unknown waveform %s.\n", value);
+                return false;
+            }
+            options->waveform = waveform;
+        } else if (strcmp(argument, "--steal") == 0) {
+            int policy = 0;
+            while (policy < STEAL_POLICIES_COUNT && strcmp(value, steal_policy_name(policy)) != 0)  policy++;
+            if (policy == STEAL_POLICIES_COUNT) {
+                printf("Unknown steal policy %s.\n", value);
+                return false;
+            }
+            options->steal_policy = policy;
+        } else if (strcmp(argument, "--wav") == 0) {
+            options->wav_path = value;
+        } else if (strcmp(argument, "--wav-format") == 0) {
+            int format = 0;
+            while (format < WAV_FORMATS_COUNT && strcmp(value, wav_format_name(format)) != 0)  format++;
+            if (format == WAV_FORMATS_COUNT) {
+                printf("Unknown wav format %s.\n", value);
+                return false;
+            }
+            options->wav_format = format;
+        } else if (strcmp(argument, "--midi") == 0) {
+            options->midi_path = value;
+        } else if (strcmp(argument, "--midi-in") == 0) {
+            options->midi_input_path = value;
+        } else {
+            printf("Unknown option %s.\n", argument);
+            return false;
+        }
+
+        if (has_value)  i++;
+    }
+
+    if (options->notes_count <= 0) {
+        printf("Nothing to render, --notes has to be positive.\n");
+        return false;
+    }
+    if (options->buffer_frames <= 0) {
+        printf("--buffer has to be positive.\n");
+        return false;
+    }
+    return true;
+}
+
+// the song again block by block on one thread, the way the render thread streams it,
+// every block is measured against the time the device takes to play it
+static void measure_streaming(NoteStore *notes, Options *options, uint32_t frames_count) {
+    SoundState data = {
+        .notes = notes,
+        .waveform = options->waveform
+    };
+    init_voice_allocator(&data.allocator, options->steal_policy, options->is_voice_pool_growable);
+    create_sound_events(&data);
+
+    float *block = malloc(sizeof(float) * options->buffer_frames * NUMBER_OF_CHANNELS);
+    assert(block != NULL && "Buy more RAM lol");
+    AudioMeter meter = { 0 };
+    double total_seconds = 0;
+
+    while (data.current_frame < frames_count) {
+        uint32_t block_frames = fmin(options->buffer_frames, frames_count - data.current_frame);
+        double start = now_seconds();
+        bool success = create_samples_from_notes(block, &data, block_frames, FRAMES_PER_TICK);
+        double seconds = now_seconds() - start;
+        if (!success)  break;
+
+        record_audio_load(&meter, seconds * 1e9, block_frames);
+        total_seconds += seconds;
+    }
+
+    printf("Stream: %u blocks of %d frames, load %.1f%% on average, %.1f%% max, %u blocks over deadline\n",
+           meter.callbacks_count, options->buffer_frames,
+           total_seconds / ((double) frames_count / SAMPLE_RATE) * 100, meter.max_load * 100, meter.overrun_count);
+
+    free(block);
+    free_sound_events(&data);
+}
+
+// the whole song into memory on every thread, like create_waveform_samples
+static bool render_song(NoteStore *notes, Options *options, uint32_t frames_count) {
+    SoundState data = {
+        .notes = notes,
+        .waveform = options->waveform
+    };
+    init_voice_allocator(&data.allocator, options->steal_policy, options->is_voice_pool_growable);
+    create_sound_events(&data);
+
+    SampleBuffer samples = { 0 };
+    resize_sample_buffer(&samples, (size_t) frames_count * NUMBER_OF_CHANNELS);
+
+    double render_start = now_seconds();
+    bool success = render_samples(samples.samples, frames_count, &data, options->threads_count);
+    double render_seconds = now_seconds() - render_start;
+
+    if (!success) {
+        printf("Render failed: %s\n", data.error_message);
+    } else {
+        double song_seconds = (double) frames_count / SAMPLE_RATE;
+        printf("Stolen voices: %d\n", data.allocator.stolen_count);
+        printf("Mix kernel: %s, threads: %d\n", mix_voices_kernel_name(), options->threads_count);
+        printf("Render: %.3f ms, %.0f samples/s, %.1fx realtime\n",
+               render_seconds * 1000,
+               frames_count * NUMBER_OF_CHANNELS / render_seconds,
+               song_seconds / render_seconds);
+    }
+
+    free_sound_events(&data);
+    free_sample_buffer(&samples);
+    return success;
+}
+
+// renders the song block by block straight into the file, memory does not grow with the song
+// the blocks are the same as render_samples makes (see synth.h), false when the file could not be written
+static bool export_wav(NoteStore *notes, Options *options, uint32_t frames_count) {
+    SoundState data = {
+        .notes = notes,
+        .waveform = options->waveform
+    };
+    init_voice_allocator(&data.allocator, options->steal_policy, options->is_voice_pool_growable);
+    create_sound_events(&data);
+
+    WavWriter writer;
+    if (!open_wav_writer(&writer, options->wav_path, options->wav_format)) {
+        free_sound_events(&data);
+        return false;
+    }
+
+    float *block = malloc(sizeof(float) * WAV_EXPORT_BLOCK_FRAMES * NUMBER_OF_CHANNELS);
+    assert(block != NULL && "Buy more RAM lol");
+    double start = now_seconds();
+
+    bool success = true;
+    while (success && data.current_frame < frames_count) {
+        uint32_t block_frames = fmin(WAV_EXPORT_BLOCK_FRAMES, frames_count - data.current_frame);
+        success = create_samples_from_notes(block, &data, block_frames, FRAMES_PER_TICK)
+               && write_wav_frames(&writer, block, block_frames);
+    }
+    success = close_wav_writer(&writer) && success;
+
+    if (success) {
+        printf("Wav: %s, %s, %s conversion, %.3f ms\n", options->wav_path, wav_format_name(options->wav_format),
+               wav_convert_kernel_name(), (now_seconds() - start) * 1000);
+    } else {
+        printf("Error writing file %s: %s\n", options->wav_path, data.error_message != NULL ? data.error_message : "write failed");
+    }
+
+    free(block);
+    free_sound_events(&data);
+    return success;
+}
+
+int main(int argc, char **argv) {
+    Options options = {
+        .seed = time(0),
+        .notes_count = GENERATED_NOTES_COUNT,
+        .threads_count = render_threads_count(),
+        .waveform = WAVEFORM_SINE,
+        .steal_policy = STEAL_RELEASING_FIRST,
+        .buffer_frames = FRAMES_PER_BUFFER
+    };
+    if (!parse_options(argc, argv, &options)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    init_voices();
+
+    NoteStore notes = { 0 };
+    if (options.midi_input_path != NULL) {
+        double read_start = now_seconds();
+        int notes_count;
+        Note *read_notes = read_midi_notes(options.midi_input_path, &notes_count);
+        if (read_notes == NULL)  return 1;
+        replace_notes(&notes, read_notes, notes_count);
+        free(read_notes);
+        printf("Read: %.3f ms\n", (now_seconds() - read_start) * 1000);
+
+        if (notes_count == 0) {
+            printf("Nothing to render, %s has no notes.\n", options.midi_input_path);
+            return 1;
+        }
+    } else {
+        generate_notes(&notes, options.seed, options.notes_count);
+    }
+
+    // notes of a file can end after the last one
+    uint32_t end_tick = 0;
+    for (int i = 0; i < notes.notes_count; i++) {
+        end_tick = fmax(end_tick, note_at(&notes, i)->end_tick);
+    }
+    uint32_t frames_count = song_frames_count(end_tick);
+    double song_seconds = (double) frames_count / SAMPLE_RATE;
+    if (options.midi_input_path == NULL)  printf("Seed: %u\n", options.seed);
+    printf("Notes: %d\n", notes.notes_count);
+    printf("Song: %.2f s, %u frames\n", song_seconds, frames_count);
+
+    if (!options.should_skip_render && !render_song(&notes, &options, frames_count))  return 1;
+    if (options.is_streaming)  measure_streaming(&notes, &options, frames_count);
+
+    // every file is still tried when one fails, scripts only see the exit code
+    bool success = true;
+    if (options.wav_path != NULL)  success = export_wav(&notes, &options, frames_count) && success;
+    if (options.midi_path != NULL)  success = save_notes_midi_file(&notes, options.threads_count, options.midi_path) && success;
+
+    free_note_store(&notes);
+    return success ? 0 : 1;
+}
@@ -0,0 +1,196 @@
+#include <stdbool.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "export.h"
+#include "synth.h"
+#include "midi.h"
+
+// both sides nap while the other one is behind, like the render thread does when playback_ring is full
+static void nap(void) {
+    struct timespec time = { 0, 1000000 };
+    nanosleep(&time, NULL);
+}
+
+static bool wait_for_block(ExportJob *job, int block, bool is_filled) {
+    while (atomic_load_explicit(&job->is_block_filled[block], memory_order_acquire) != is_filled) {
+        if (atomic_load(&job->should_cancel))  return false;
+        nap();
+    }
+    return true;
+}
+
+typedef struct {
+    ExportJob *job;
+    WavWriter *writer;
+    bool did_fail;
+} ExportWriter;
+
+static void *export_writer_main(void *argument) {
+    ExportWriter *export_writer = argument;
+    ExportJob *job = export_writer->job;
+
+    uint32_t written_frames = 0;
+    for (int block = 0; wait_for_block(job, block, true); block ^= 1) {
+        uint32_t frames_count = job->block_frames[block];
+        if (frames_count == 0)  break;
+
+        if (!write_wav_frames(export_writer->writer, job->blocks[block], frames_count)) {
+            export_writer->did_fail = true;
+            atomic_store(&job->should_cancel, true);
+            break;
+        }
+        written_frames += frames_count;
+        atomic_store(&job->progress, (float) written_frames / job->frames_count);
+        atomic_store_explicit(&job->is_block_filled[block], false, memory_order_release);
+    }
+    return NULL;
+}
+
+static bool export_wav(ExportJob *job) {
+    WavWriter writer;
+    if (!open_wav_writer(&writer, job->path, job->settings.wav_format)) {
+        snprintf(job->result, sizeof(job->result), "Error opening file %s", job->path);
+        return false;
+    }
+
+    SoundState data = {
+        .notes = &job->notes,
+        .waveform = job->settings.waveform
+    };
+    init_voice_allocator(&data.allocator, job->settings.steal_policy, job->settings.is_voice_pool_growable);
+    create_sound_events(&data);
+
+    for (int block = 0; block < 2; block++) {
+        job->blocks[block] = malloc(sizeof(float) * EXPORT_BLOCK_FRAMES * NUMBER_OF_CHANNELS);
+        assert(job->blocks[block] != NULL && "Buy more RAM lol");
+        atomic_store(&job->is_block_filled[block], false);
+    }
+
+    ExportWriter export_writer = { job, &writer, false };
+    pthread_t writer_thread;
+    bool has_writer_thread = pthread_create(&writer_thread, NULL, export_writer_main, &export_writer) == 0;
+    bool did_render = has_writer_thread;
+
+    // the last block is empty and tells the writer the song is over
+    int block = 0;
+    while (did_render && wait_for_block(job, block, false)) {
+        uint32_t frames_count = fmin(EXPORT_BLOCK_FRAMES, job->frames_count - data.current_frame);
+        if (frames_count > 0 && !create_samples_from_notes(job->blocks[block], &data, frames_count, FRAMES_PER_TICK)) {
+            did_render = false;
+            atomic_store(&job->should_cancel, true);
+            break;
+        }
+
+        job->block_frames[block] = frames_count;
+        atomic_store_explicit(&job->is_block_filled[block], true, memory_order_release);
+        if (frames_count == 0)  break;
+        block ^= 1;
+    }
+
+    if (has_writer_thread)  pthread_join(writer_thread, NULL);
+    bool success = close_wav_writer(&writer) && did_render && !export_writer.did_fail && !atomic_load(&job->should_cancel);
+
+    if (success) {
+        snprintf(job->result, sizeof(job->result), "Exported %s", job->path);
+    } else {
+        unlink(job->path);
+        if (!has_writer_thread)          snprintf(job->result, sizeof(job->result), "Error starting export writer thread");
+        else if (!did_render)            snprintf(job->result, sizeof(job->result), "Export failed: %s", data.error_message != NULL ? data.error_message : "render failed");
+        else if (export_writer.did_fail) snprintf(job->result, sizeof(job->result), "Error writing file %s", job->path);
+        else                             snprintf(job->result, sizeof(job->result), "Export of %s cancelled", job->path);
+    }
+
+    for (int block = 0; block < 2; block++) {
+        free(job->blocks[block]);
+        job->blocks[block] = NULL;
+    }
+    free_sound_events(&data);
+    return success;
+}
+
+static bool export_midi(ExportJob *job) {
+    if (atomic_load(&job->should_cancel)) {
+        snprintf(job->result, sizeof(job->result), "Export of %s cancelled", job->path);
+        return false;
+    }
+
+    if (!save_notes_midi_file(&job->notes, job->settings.threads_count, job->path)) {
+        unlink(job->path);
+        snprintf(job->result, sizeof(job->result), "Error writing file %s", job->path);
+        return false;
+    }
+    atomic_store(&job->progress, 1);
+    snprintf(job->result, sizeof(job->result), "Exported %s", job->path);
+    return true;
+}
+
+static void *export_main(void *argument) {
+    ExportJob *job = argument;
+    job->did_succeed = job->settings.kind == EXPORT_WAV ? export_wav(job) : export_midi(job);
+    printf("%s\n", job->result);
+    atomic_store(&job->is_finished, true);
+    return NULL;
+}
+
+bool start_export_job(ExportJob *job, const NoteStore *notes, ExportSettings settings) {
+    if (job->is_running)  return false;
+
+    job->settings = settings;
+    snprintf(job->path, sizeof(job->path), "%s", settings.path);
+    job->settings.path = job->path;
+    atomic_store(&job->progress, 0);
+    atomic_store(&job->should_cancel, false);
+    atomic_store(&job->is_finished, false);
+
+    // deleted notes are left out, the copy is sorted like the notes are
+    uint32_t end_tick = 0;
+    clear_note_store(&job->notes);
+    for (int i = 0; i < notes->notes_count; i++) {
+        const Note *note = note_at(notes, i);
+        if (note->is_deleted)  continue;
+        add_note(&job->notes, *note);
+        end_tick = fmax(end_tick, note->end_tick);
+    }
+    job->frames_count = job->notes.notes_count == 0 ? 0 : song_frames_count(end_tick);
+
+    if (pthread_create(&job->thread, NULL, export_main, job) != 0) {
+        snprintf(job->message, sizeof(job->message), "Error starting export thread");
+        return false;
+    }
+    job->is_running = true;
+    snprintf(job->message, sizeof(job->message), "Exporting %s", job->path);
+    return true;
+}
+
+float export_job_progress(ExportJob *job) {
+    if (!job->is_running)  return 0;
+    return atomic_load(&job->progress);
+}
+
+void cancel_export_job(ExportJob *job) {
+    atomic_store(&job->should_cancel, true);
+}
+
+bool finish_export_job(ExportJob *job) {
+    if (!job->is_running || !atomic_load(&job->is_finished))  return false;
+
+    pthread_join(job->thread, NULL);
+    job->is_running = false;
+    memcpy(job->message, job->result, sizeof(job->message));
+    free_note_store(&job->notes);
+    return true;
+}
+
+void stop_export_job(ExportJob *job) {
+    if (!job->is_running)  return;
+
+    cancel_export_job(job);
+    while (!finish_export_job(job))  nap();
+}
@@ -0,0 +1,73 @@
+#ifndef EXPORT_INCLUDES
+#define EXPORT_INCLUDES
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "shared.h"
+#include "notes.h"
+#include "voices.h"
+#include "wav.h"
+
+#define EXPORT_BLOCK_FRAMES (1 << 16) // frames of each half of the wav double buffer
+#define EXPORT_PATH_LENGTH  256
+#define EXPORT_MESSAGE_LENGTH (EXPORT_PATH_LENGTH + 64)
+
+typedef enum {
+    EXPORT_WAV,
+    EXPORT_MIDI
+} ExportKind;
+
+typedef struct {
+    ExportKind kind;
+    const char *path;
+    Waveform waveform;
+    StealPolicy steal_policy;
+    bool is_voice_pool_growable;
+    WavFormat wav_format;
+    int threads_count; // midi tracks are encoded on this many threads
+} ExportSettings;
+
+// an export running on its own thread from a copy of the notes, the ui keeps editing the real ones
+// wav exports render the song block by block into one half of a double buffer while a writer thread
+// writes the other half to the file
+typedef struct {
+    ExportSettings settings;
+    char path[EXPORT_PATH_LENGTH];
+    NoteStore notes; // snapshot taken by start_export_job, only the job reads it
+    uint32_t frames_count;
+
+    float *blocks[2];
+    uint32_t block_frames[2];        // 0 in a filled block means the song is over
+    atomic_bool is_block_filled[2];  // set by the renderer, cleared by the writer once the block is in the file
+    _Atomic float progress;
+
+    pthread_t thread;
+    bool is_running;                 // ui side: started and not collected by finish_export_job yet
+    atomic_bool should_cancel;
+    atomic_bool is_finished;
+    bool did_succeed;                // read after is_finished
+    char result[EXPORT_MESSAGE_LENGTH];   // written by the job, read after is_finished
+    char message[EXPORT_MESSAGE_LENGTH];  // ui side: what the job is doing or how the last one ended, for the console
+} ExportJob;
+
+// ui thread: copies the notes and starts the job, false when one is already running
+bool start_export_job(ExportJob *job, const NoteStore *notes, ExportSettings settings);
+
+// 0 -> 1, wav progress is what's been written to the file
+// a midi file is made and written in one go: it stays at 0 until it's written, then jumps to 1
+float export_job_progress(ExportJob *job);
+
+// the job stops at the next block and removes its file
+// midi jobs can only be cancelled before they start writing, a cancel after that is ignored
+void cancel_export_job(ExportJob *job);
+
+// ui thread, every frame: collects a finished job (joins its thread, frees the snapshot), true when it did
+bool finish_export_job(ExportJob *job);
+
+// cancels a running job and waits for it, the library can't be unloaded while it runs
+void stop_export_job(ExportJob *job);
+
+#endif // EXPORT_INCLUDES
@@ -0,0 +1,13 @@
+#ifndef HOST_INCLUDES
+#define HOST_INCLUDES
+
+#include "trace.h"
+#include "meter.h"
+
+// what the host owns and lends to every library copy it loads, it outlives them all
+typedef struct {
+    Tracer *tracer;
+    AudioMeter *audio_meter;
+} HostContext;
+
+#endif // HOST_INCLUDES
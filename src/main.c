@@ -1,4 +1,7 @@
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
 #include <dlfcn.h>
 #include "raylib.h"
 
@@ -7,46 +10,255 @@
 #include <unistd.h>
 #include <time.h>
 
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <pthread.h>
+#include <errno.h>
+#endif
+
 #define MINIAUDIO_IMPLEMENTATION
 #include "miniaudio.h"
 
-void *plugin_handle;
-void (*plug_init)(void);
-void (*plug_update)(void);
-void (*plug_cleanup)(void);
-void* (*plug_pre_reload)(void);
-void (*plug_post_reload)(void*);
+#include "shared.h"
+#include "host.h"
+
+typedef void (*PlugAudioCallback)(float *frames, uint32_t frame_count);
+
+typedef struct {
+    void *handle;
+    char path[64]; // a copy of library_path, so the next version can be loaded while this one still runs
+    void (*plug_init)(void);
+    void (*plug_update)(void);
+    void (*plug_cleanup)(void);
+    void* (*plug_pre_reload)(void);
+    void (*plug_post_reload)(void*);
+    void (*plug_set_host)(HostContext*);
+    PlugAudioCallback plug_audio_callback;
+} Plugin;
+
+Plugin plugin;
+Tracer tracer; // F9 starts and stops recording to trace_path
+char *trace_path = "./trace.json";
+AudioMeter audio_meter;
+HostContext host_context = { &tracer, &audio_meter };
 
+// the host owns the device so it keeps running across reloads, the callback goes through this pointer
+ma_device audio_device;
+_Atomic(PlugAudioCallback) audio_callback_function = NULL;
+atomic_int running_audio_callbacks_count = 0;
+
+char *library_directory = "./build";
+char *library_file_name = "libplug.so";
 char *library_path = "./build/libplug.so";
+char *library_copy_path_format = "./build/libplug.loaded.%d.so";
 char *library_lockfile_path = "./build/libplug.lock";
 time_t last_library_load_time = 0;
+int library_copies_count = 0;
+atomic_bool is_library_modified = false;
+
+bool copy_file(char *source_path, char *destination_path) {
+    FILE *source = fopen(source_path, "rb");
+    if (!source)  return false;
+    FILE *destination = fopen(destination_path, "wb");
+    if (!destination) {
+        fclose(source);
+        return false;
+    }
+
+    char buffer[64 * 1024];
+    size_t bytes_count;
+    bool success = true;
+    while ((bytes_count = fread(buffer, 1, sizeof(buffer), source)) > 0) {
+        if (fwrite(buffer, 1, bytes_count, destination) != bytes_count) {
+            success = false;
+            break;
+        }
+    }
+
+    fclose(source);
+    if (fclose(destination) != 0)  success = false;
+    return success;
+}
+
+void unload_library(Plugin *loaded) {
+    if (loaded->handle)  dlclose(loaded->handle);
+    unlink(loaded->path);
+    *loaded = (Plugin) { 0 };
+}
+
+// loads a copy of the library, dlopen would return the already loaded one for the same path
+bool load_library(Plugin *loaded) {
+    *loaded = (Plugin) { 0 };
+    sprintf(loaded->path, library_copy_path_format, library_copies_count++);
+    if (!copy_file(library_path, loaded->path)) {
+        printf("main.c: load_library: Error: could not copy %s to %s\n", library_path, loaded->path);
+        return false;
+    }
 
-bool load_library(void) {
-    if (plugin_handle) dlclose(plugin_handle);
-
-    plugin_handle = dlopen(library_path, RTLD_LAZY);
-    if (!plugin_handle) goto fail;
-    plug_init = dlsym(plugin_handle, "plug_init");
-    if (!plug_init) goto fail;
-    plug_update = dlsym(plugin_handle, "plug_update");
-    if (!plug_update) goto fail;
-    plug_pre_reload = dlsym(plugin_handle, "plug_pre_reload");
-    if (!plug_pre_reload) goto fail;
-    plug_post_reload = dlsym(plugin_handle, "plug_post_reload");
-    if (!plug_post_reload) goto fail;
-    plug_cleanup = dlsym(plugin_handle, "plug_cleanup");
-    if (!plug_cleanup) goto fail;
+    loaded->handle = dlopen(loaded->path, RTLD_LAZY | RTLD_LOCAL);
+    if (!loaded->handle) goto fail;
+    loaded->plug_init = dlsym(loaded->handle, "plug_init");
+    if (!loaded->plug_init) goto fail;
+    loaded->plug_update = dlsym(loaded->handle, "plug_update");
+    if (!loaded->plug_update) goto fail;
+    loaded->plug_pre_reload = dlsym(loaded->handle, "plug_pre_reload");
+    if (!loaded->plug_pre_reload) goto fail;
+    loaded->plug_post_reload = dlsym(loaded->handle, "plug_post_reload");
+    if (!loaded->plug_post_reload) goto fail;
+    loaded->plug_cleanup = dlsym(loaded->handle, "plug_cleanup");
+    if (!loaded->plug_cleanup) goto fail;
+    loaded->plug_audio_callback = dlsym(loaded->handle, "plug_audio_callback");
+    if (!loaded->plug_audio_callback) goto fail;
+    loaded->plug_set_host = dlsym(loaded->handle, "plug_set_host");
+    if (!loaded->plug_set_host) goto fail;
 
+    loaded->plug_set_host(&host_context);
     last_library_load_time = time(NULL);
     return true; 
 
 fail:
     printf("main.c: load_library: Error: %s\n", dlerror());
-    if (plugin_handle) dlclose(plugin_handle);
+    unload_library(loaded);
     return false;
 }
 
+void audio_callback(ma_device *device, void *output, const void *input, ma_uint32 frame_count) {
+    (void)device;
+    (void)input;
+
+    uint64_t start_time = trace_time();
+
+    // counted before the pointer is read, so set_audio_callback_function knows when the old code is not running anymore
+    atomic_fetch_add(&running_audio_callbacks_count, 1);
+    PlugAudioCallback callback = atomic_load(&audio_callback_function);
+    if (callback) {
+        callback(output, frame_count);
+    } else {
+        memset(output, 0, sizeof(float) * frame_count * NUMBER_OF_CHANNELS);
+    }
+    atomic_fetch_sub(&running_audio_callbacks_count, 1);
+
+    uint64_t end_time = trace_time();
+    measure_audio_callback(&audio_meter, start_time, end_time, frame_count);
+    trace_span(&tracer, TRACE_THREAD_AUDIO, "audio_callback", start_time, end_time - start_time);
+}
+
+// returns once no callback runs the previous function anymore
+void set_audio_callback_function(PlugAudioCallback callback) {
+    atomic_store(&audio_callback_function, callback);
+    while (atomic_load(&running_audio_callbacks_count) > 0) {
+        struct timespec nap = { 0, 100000 };
+        nanosleep(&nap, NULL);
+    }
+}
+
+bool init_audio_device(void) {
+    ma_device_config config = ma_device_config_init(ma_device_type_playback);
+    config.playback.format = ma_format_f32;
+    config.playback.channels = NUMBER_OF_CHANNELS;
+    config.sampleRate = SAMPLE_RATE;
+    config.dataCallback = audio_callback;
+
+    // period size can be tried out without rebuilding, the device picks one otherwise
+    char *period_frames = getenv("MISEQ_PERIOD_FRAMES");
+    if (period_frames != NULL)  config.periodSizeInFrames = atoi(period_frames);
+
+    if (ma_device_init(NULL, &config, &audio_device) != MA_SUCCESS) {
+        printf("Error initializing audio device.\n");
+        return false;
+    }
+
+    ma_device_start(&audio_device);
+    printf("Audio device initialized and started, period of %u frames.\n", audio_device.playback.internalPeriodSizeInFrames);
+    return true;
+}
+
+// the old library keeps playing until the new one has the state, then the callback switches between two calls
+void reload_library(void) {
+    uint64_t start_time = trace_time();
+    Plugin new_plugin;
+    if (!load_library(&new_plugin)) {
+        printf("Hotreloading failed, keeping the old library\n");
+        last_library_load_time = time(NULL); // try again on the next change
+        trace_span(&tracer, TRACE_THREAD_UI, "hot reload failed", start_time, trace_time() - start_time);
+        return;
+    }
+
+    void *state = plugin.plug_pre_reload();
+    new_plugin.plug_post_reload(state);
+    set_audio_callback_function(new_plugin.plug_audio_callback);
+
+    unload_library(&plugin);
+    plugin = new_plugin;
+    printf("Hotreloading successful\n");
+    trace_span(&tracer, TRACE_THREAD_UI, "hot reload", start_time, trace_time() - start_time);
+}
+
+#ifdef __linux__
+
+// blocks on inotify events of the build directory, the main loop only checks is_library_modified
+void *watch_library(void *argument) {
+    (void)argument;
+
+    int watcher = inotify_init1(IN_CLOEXEC);
+    if (watcher < 0 || inotify_add_watch(watcher, library_directory, IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE) < 0) {
+        printf("main.c: watch_library: Error: %s, reloading on changes is off\n", strerror(errno));
+        if (watcher >= 0)  close(watcher);
+        return NULL;
+    }
+
+    bool is_library_written = false; // waits for the lock file to be removed
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while (true) {
+        ssize_t length = read(watcher, buffer, sizeof(buffer));
+        if (length < 0 && errno == EINTR)  continue;
+        if (length <= 0)  break;
+
+        for (char *position = buffer; position < buffer + length;) {
+            struct inotify_event *event = (struct inotify_event *) position;
+            position += sizeof(struct inotify_event) + event->len;
+
+            bool is_library = event->len > 0 && strcmp(event->name, library_file_name) == 0;
+            if (is_library && (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))) {
+                is_library_written = true;
+            }
+        }
+
+        // the makefile removes the lock file after linking
+        if (is_library_written && access(library_lockfile_path, F_OK) != 0) {
+            is_library_written = false;
+            atomic_store(&is_library_modified, true);
+        }
+    }
+
+    close(watcher);
+    return NULL;
+}
+
+void start_library_watcher(void) {
+    pthread_t watcher_thread;
+    if (pthread_create(&watcher_thread, NULL, watch_library, NULL) != 0) {
+        printf("main.c: start_library_watcher: Error: could not start the watcher thread\n");
+        return;
+    }
+    pthread_detach(watcher_thread);
+}
+
 bool is_library_file_modified(void) {
+    return atomic_exchange(&is_library_modified, false);
+}
+
+#else
+
+void start_library_watcher(void) {}
+
+// no inotify here: the library is checked a few times a second instead
+bool is_library_file_modified(void) {
+    static double last_check_time = 0;
+    if (GetTime() - last_check_time < 0.25)  return false;
+    last_check_time = GetTime();
+
     struct stat attributes;
     stat(library_path, &attributes);
     time_t modified_time = attributes.st_mtime;
@@ -60,8 +272,10 @@ bool is_library_file_modified(void) {
     return true;
 }
 
+#endif
+
 int main(void) {
-    if (!load_library()) return 1;
+    if (!load_library(&plugin)) return 1;
 
     SetConfigFlags(FLAG_WINDOW_RESIZABLE);
     SetConfigFlags(FLAG_MSAA_4X_HINT);
@@ -69,28 +283,31 @@ int main(void) {
     InitWindow(1200, 800, "miseq");
     SetTargetFPS(120);
 
-    plug_init();
+    plugin.plug_init();
+    start_library_watcher();
+    bool has_audio_device = init_audio_device();
+    set_audio_callback_function(plugin.plug_audio_callback);
 
     while(!WindowShouldClose()) {
-        if (is_library_file_modified()) {
-            void *state = plug_pre_reload();
-            if (!load_library())  break;
-            plug_post_reload(state);
-            printf("Hotreloading successful\n");
+        if (is_library_file_modified() || IsKeyPressed(KEY_BACKSLASH)) {
+            reload_library();
         }
 
-        if (IsKeyPressed(KEY_BACKSLASH)) {
-            void *state = plug_pre_reload();
-            if (!load_library())  break;
-            plug_post_reload(state);
-            printf("Hotreloading successful\n");
+        if (IsKeyPressed(KEY_F9)) {
+            if (atomic_load(&tracer.is_recording))  stop_trace(&tracer);
+            else  start_trace(&tracer, trace_path);
         }
 
-        plug_update();
+        uint64_t frame_start_time = trace_time();
+        plugin.plug_update();
+        trace_span(&tracer, TRACE_THREAD_UI, "plug_update", frame_start_time, trace_time() - frame_start_time);
     }
 
-    plug_cleanup();
-    dlclose(plugin_handle);
+    stop_trace(&tracer);
+    set_audio_callback_function(NULL);
+    if (has_audio_device)  ma_device_uninit(&audio_device);
+    plugin.plug_cleanup();
+    unload_library(&plugin);
     CloseWindow();
     return 0;
 }
@@ -0,0 +1,60 @@
+#include <stdbool.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "shared.h"
+#include "meter.h"
+
+#define LOAD_SMOOTHING 0.05f
+
+static uint64_t frames_nanoseconds(uint32_t frames_count) {
+    return (uint64_t) frames_count * 1000000000 / SAMPLE_RATE;
+}
+
+void measure_audio_callback(AudioMeter *meter, uint64_t start_time, uint64_t end_time, uint32_t frame_count) {
+    // the device asks for the next period once the previous one is played, a longer gap means it ran dry
+    if (meter->last_frames_count > 0) {
+        double period = frames_nanoseconds(meter->last_frames_count);
+        double periods_count = (start_time - meter->last_start_time) / period;
+        if (periods_count > LATE_CALLBACK_PERIODS) {
+            atomic_fetch_add_explicit(&meter->late_count, 1, memory_order_relaxed);
+            atomic_fetch_add_explicit(&meter->missed_periods_count, (unsigned int) round(periods_count) - 1, memory_order_relaxed);
+        }
+    }
+    meter->last_start_time = start_time;
+    meter->last_frames_count = frame_count;
+
+    record_audio_load(meter, end_time - start_time, frame_count);
+}
+
+void record_audio_load(AudioMeter *meter, uint64_t duration, uint32_t frame_count) {
+    if (frame_count == 0)  return;
+
+    float load = (float) duration / frames_nanoseconds(frame_count);
+    if (load > 1)  atomic_fetch_add_explicit(&meter->overrun_count, 1, memory_order_relaxed);
+
+    float smoothed_load = atomic_load_explicit(&meter->load, memory_order_relaxed);
+    atomic_store_explicit(&meter->load, smoothed_load + (load - smoothed_load) * LOAD_SMOOTHING, memory_order_relaxed);
+    if (load > atomic_load_explicit(&meter->max_load, memory_order_relaxed)) {
+        atomic_store_explicit(&meter->max_load, load, memory_order_relaxed);
+    }
+
+    atomic_store_explicit(&meter->period_frames, frame_count, memory_order_relaxed);
+    atomic_fetch_add_explicit(&meter->callbacks_count, 1, memory_order_relaxed);
+}
+
+void count_starved_callback(AudioMeter *meter) {
+    atomic_fetch_add_explicit(&meter->starved_count, 1, memory_order_relaxed);
+}
+
+void reset_audio_meter(AudioMeter *meter) {
+    atomic_store(&meter->callbacks_count, 0);
+    atomic_store(&meter->late_count, 0);
+    atomic_store(&meter->missed_periods_count, 0);
+    atomic_store(&meter->overrun_count, 0);
+    atomic_store(&meter->starved_count, 0);
+    atomic_store(&meter->max_load, 0);
+}
@@ -0,0 +1,38 @@
+#ifndef METER_INCLUDES
+#define METER_INCLUDES
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define LATE_CALLBACK_PERIODS 1.5 // a callback starting this many periods after the previous one is an xrun
+
+// dsp load and xruns of the audio callback, written by the audio thread and read by anyone
+// load is callback duration / deadline, the deadline being the time the device needs to play frame_count frames
+typedef struct {
+    atomic_uint callbacks_count;
+    atomic_uint late_count;           // callbacks that started more than LATE_CALLBACK_PERIODS after the previous one
+    atomic_uint missed_periods_count; // whole periods the late callbacks skipped
+    atomic_uint overrun_count;        // callbacks that took longer than their deadline
+    atomic_uint starved_count;        // callbacks the render thread had nothing ready for while a song played
+    _Atomic float load;               // smoothed over the last ~20 callbacks
+    _Atomic float max_load;
+    atomic_uint period_frames;        // frames of the last callback
+
+    // audio thread only
+    uint64_t last_start_time;
+    uint32_t last_frames_count;
+} AudioMeter;
+
+// audio thread: times of the callback (same clock as trace_time), detects late callbacks and records the load
+void measure_audio_callback(AudioMeter *meter, uint64_t start_time, uint64_t end_time, uint32_t frame_count);
+
+// load of a block made in duration nanoseconds, for renders that are not paced by a device (headless tools)
+void record_audio_load(AudioMeter *meter, uint64_t duration, uint32_t frame_count);
+
+void count_starved_callback(AudioMeter *meter);
+
+// counters and max load start over, load keeps going
+void reset_audio_meter(AudioMeter *meter);
+
+#endif // METER_INCLUDES
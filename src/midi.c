@@ -6,194 +6,622 @@
 #include <string.h>
 #include <math.h>
 #include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "midi.h"
 
+#define HEADER_CHUNK_SIZE   14
+#define TRACK_CHUNK_START   8 // "MTrk" and the chunk length
+#define END_OF_TRACK_SIZE   4 // delta time 0 and ff 2f 00
+#define NOTE_MESSAGE_SIZE   2 // key and velocity, the status byte is shared by the track
+#define TEMPO_EVENT_SIZE    7
+#define TEMPO_TRACK_SIZE    (TRACK_CHUNK_START + TEMPO_EVENT_SIZE + END_OF_TRACK_SIZE)
+
 typedef struct {
+    uint32_t tick;
     uint8_t key;
     uint8_t velocity;
-    uint32_t tick;
     bool is_on;
 } NoteEvent;
 
-uint32_t le_to_be(uint32_t num) {
-    uint8_t b[4] = {0};
-    *(uint32_t*)b = num;
-    uint8_t tmp = 0;
-    tmp = b[0];
-    b[0] = b[3];
-    b[3] = tmp;
-    tmp = b[1];
-    b[1] = b[2];
-    b[2] = tmp;
-    return *(uint32_t*)b;
+void reserve_midi_buffer(MidiBuffer *buffer, int count) {
+    assert(count >= 0 && buffer->size <= INT32_MAX - count && "Midi file over 2GB");
+    if (buffer->size + count <= buffer->capacity)  return;
+
+    int capacity = buffer->capacity == 0 ? count : buffer->capacity;
+    while (capacity < buffer->size + count) {
+        capacity = capacity > INT32_MAX / 2 ? INT32_MAX : capacity * 2;
+    }
+    buffer->data = realloc(buffer->data, capacity);
+    assert(buffer->data != NULL && "Buy more RAM lol");
+    buffer->capacity = capacity;
+}
+
+void free_midi_buffer(MidiBuffer *buffer) {
+    free(buffer->data);
+    *buffer = (MidiBuffer) { 0 };
 }
 
-static void append_string(void *data, int *size, const char* bytes) {
-    char* pointer = (char*)data + *size;
-    unsigned long len = strlen(bytes);
-    memcpy(pointer, bytes, len);
-    *size += len;
+static inline void append_byte(MidiBuffer *buffer, uint8_t byte) {
+    if (buffer->size == buffer->capacity)  reserve_midi_buffer(buffer, 1);
+    buffer->data[buffer->size++] = byte;
 }
 
-static void append_byte(void *data, int *size, int8_t byte) {
-    int8_t* pointer = (int8_t*)data + *size;
-    memcpy(pointer, &byte, 1);
-    *size += 1;
+static void append_string(MidiBuffer *buffer, const char *bytes) {
+    int length = strlen(bytes);
+    reserve_midi_buffer(buffer, length);
+    memcpy(buffer->data + buffer->size, bytes, length);
+    buffer->size += length;
 }
 
-static void append_note_on(void *data, int *size, uint8_t key, uint8_t velocity) {
-    append_byte(data, size, 0x90); // channel 0
-    append_byte(data, size, key);
-    append_byte(data, size, velocity);
+// midi numbers are big endian
+static void append_uint32(MidiBuffer *buffer, uint32_t value) {
+    append_byte(buffer, value >> 24);
+    append_byte(buffer, value >> 16);
+    append_byte(buffer, value >> 8);
+    append_byte(buffer, value);
 }
 
-static void append_note_off(void *data, int *size, uint8_t key, uint8_t velocity) {
-    append_byte(data, size, 0x80); // channel 0
-    append_byte(data, size, key);
-    append_byte(data, size, velocity);
+static void append_uint16(MidiBuffer *buffer, uint16_t value) {
+    append_byte(buffer, value >> 8);
+    append_byte(buffer, value);
 }
 
-static void append_delta_time(void *data, int *size, uint32_t ticks) {
+// note offs are note ons with velocity 0 so every event of a track shares the status byte,
+// which is only written once (running status)
+static void append_note_event(MidiBuffer *buffer, NoteEvent event, bool has_status) {
+    if (!has_status)  append_byte(buffer, 0x90); // channel 0
+    append_byte(buffer, event.key);
+    append_byte(buffer, event.is_on ? event.velocity : 0);
+}
+
+int delta_time_size(uint32_t ticks) {
+    int size = 1;
+    while (ticks > 127) {
+        ticks >>= 7;
+        size++;
+    }
+    return size;
+}
+
+// VLQ format: 7 bits per byte, most significant first, the MSB is set on all but the last byte
+void append_delta_time(MidiBuffer *buffer, uint32_t ticks) {
     if (ticks <= 127) {
-        append_byte(data, size, (uint8_t) ticks);
-    } else { // VLQ format
-        uint32_t ticks_left = ticks;
-        uint8_t buffer[5]; // maximum 5 bytes for a 32-bit number
-        int count = 0;
-
-        while (ticks_left > 0) {
-            buffer[count++] = (uint8_t)(ticks_left & 0x7F);
-            ticks_left >>= 7;
-        }
+        append_byte(buffer, (uint8_t) ticks);
+        return;
+    }
 
-        // reverse the order of bytes and set the MSB to 1 for all but the last byte
-        for (int i = count - 1; i >= 0; --i) {
-            uint8_t byte = buffer[i];
-            if (i != 0) {
-                byte |= 0x80; // set MSB to 1 for continuation
-            }
-            append_byte(data, size, byte);
-        }
+    for (int shift = 7 * (delta_time_size(ticks) - 1); shift > 0; shift -= 7) {
+        append_byte(buffer, (uint8_t)((ticks >> shift) & 0x7F) | 0x80);
     }
+    append_byte(buffer, (uint8_t)(ticks & 0x7F));
 }
 
-static void append_header(void *data, int *size) {
-    append_string(data, size, "MThd");
+static void append_header(MidiBuffer *buffer, int tracks_count) {
+    append_string(buffer, "MThd");
+    append_uint32(buffer, 6); // header length is always 6
+    append_uint16(buffer, 1); // format type: 0 single, 1 multi synced, 2 multi independent
+    append_uint16(buffer, tracks_count);
+    append_uint16(buffer, MIDI_TICKS_PER_QUARTER); // timing resolution
+}
 
-    // chunk length (4 bytes): header is always 6
-    append_byte(data, size, 0);
-    append_byte(data, size, 0);
-    append_byte(data, size, 0);
-    append_byte(data, size, 6);
+// stable LSD radix sort by tick, a byte at a time, skipping the bytes every tick shares
+// (the high bytes of a song that isn't hours long), temp has to hold count events
+static void radix_sort_note_events(NoteEvent *events, NoteEvent *temp, int count) {
+    int histograms[4][256] = { 0 };
+    for (int i = 0; i < count; i++) {
+        uint32_t tick = events[i].tick;
+        histograms[0][tick & 0xff]++;
+        histograms[1][(tick >> 8) & 0xff]++;
+        histograms[2][(tick >> 16) & 0xff]++;
+        histograms[3][tick >> 24]++;
+    }
 
-    // format type (2 bytes): 0 single, 1 multi synced, 2 multi independent
-    append_byte(data, size, 0);
-    append_byte(data, size, 0);
+    NoteEvent *source = events;
+    NoteEvent *destination = temp;
+    for (int pass = 0; pass < 4; pass++) {
+        int *histogram = histograms[pass];
+        int shift = pass * 8;
+        if (count == 0 || histogram[(source[0].tick >> shift) & 0xff] == count)  continue;
+
+        int offset = 0;
+        for (int byte = 0; byte < 256; byte++) {
+            int byte_count = histogram[byte];
+            histogram[byte] = offset;
+            offset += byte_count;
+        }
+        for (int i = 0; i < count; i++) {
+            destination[histogram[(source[i].tick >> shift) & 0xff]++] = source[i];
+        }
 
-    // number of tracks (2 bytes)
-    append_byte(data, size, 0);
-    append_byte(data, size, 1);
+        NoteEvent *swap = source;
+        source = destination;
+        destination = swap;
+    }
 
-    // timing resolution (2 bytes)
-    append_byte(data, size, 0x00);
-    append_byte(data, size, 0x60);
+    if (source != events)  memcpy(events, source, sizeof(NoteEvent) * count);
 }
 
-static int compare_note_events(const void *a, const void *b) {
-    const NoteEvent *note1 = (const NoteEvent *)a;
-    const NoteEvent *note2 = (const NoteEvent *)b;
-    if (note1->tick < note2->tick) return -1;
-    else if (note1->tick > note2->tick) return 1;
-    else return 0;
+// the first track only sets the tempo, the notes are in one track per octave after it
+typedef struct {
+    const NoteStore *notes;
+    int *positions;                              // of the notes of every octave, octave after octave
+    int octave_starts[MIDI_NOTE_TRACKS_COUNT + 1];
+    MidiBuffer tracks[MIDI_NOTE_TRACKS_COUNT];   // whole track chunks, empty for octaves without notes
+    atomic_int next_track;
+} MidiJob;
+
+static void append_end_of_track(MidiBuffer *buffer) {
+    append_delta_time(buffer, 0);
+    append_byte(buffer, 0xff);
+    append_byte(buffer, 0x2f);
+    append_byte(buffer, 0);
 }
 
-static void append_events_from_notes(void *data, int *size, Note *notes, int notes_count) {
-    int events_count = notes_count * 2;
-    NoteEvent events[events_count];
+static void append_tempo_track(MidiBuffer *buffer) {
+    append_string(buffer, "MTrk");
+    append_uint32(buffer, TEMPO_EVENT_SIZE + END_OF_TRACK_SIZE);
+
+    // 500000 microseconds per quarter note is the default 120 bpm, written for the players that want it
+    append_delta_time(buffer, 0);
+    append_byte(buffer, 0xff);
+    append_byte(buffer, 0x51);
+    append_byte(buffer, 3);
+    append_byte(buffer, 0x07);
+    append_byte(buffer, 0xa1);
+    append_byte(buffer, 0x20);
+
+    append_end_of_track(buffer);
+}
 
-    for (int i = 0; i < notes_count; i++) {
-        Note note = notes[i];
-        events[i] = (NoteEvent) {
-            note.key, note.velocity, note.start_tick, true
-        };
-        events[notes_count + i] = (NoteEvent) {
-            note.key, note.velocity, note.end_tick, false
-        };
+// note ons come in start_tick order since the notes are sorted, only note offs need sorting,
+// then both are merged with offs first on the same tick so a key played again is released before
+static void append_note_track(MidiBuffer *buffer, const NoteStore *notes, const int *positions, int count) {
+    NoteEvent *ons = malloc(sizeof(NoteEvent) * count * 3);
+    NoteEvent *events = malloc(sizeof(NoteEvent) * count * 2);
+    assert(ons != NULL && events != NULL && "Buy more RAM lol");
+    NoteEvent *offs = ons + count;
+    NoteEvent *temp = offs + count;
+
+    bool are_ons_sorted = true;
+    for (int i = 0; i < count; i++) {
+        const Note *note = note_at(notes, positions[i]);
+        ons[i] = (NoteEvent) { note->start_tick, note->key, note->velocity, true };
+        offs[i] = (NoteEvent) { note->end_tick, note->key, note->velocity, false };
+        if (i > 0 && ons[i - 1].tick > note->start_tick)  are_ons_sorted = false;
     }
 
-    qsort(events, events_count, sizeof(NoteEvent), compare_note_events);
+    if (!are_ons_sorted)  radix_sort_note_events(ons, temp, count);
+    radix_sort_note_events(offs, temp, count);
 
-    uint32_t current_tick = 0;    
-    for (int i = 0; i < events_count; i++) {
-        NoteEvent event = events[i];
+    int events_size = 1; // the status byte
+    uint32_t current_tick = 0;
+    int on_index = 0, off_index = 0;
+    for (int i = 0; i < count * 2; i++) {
+        bool is_off_next = on_index == count || (off_index < count && offs[off_index].tick <= ons[on_index].tick);
+        NoteEvent event = is_off_next ? offs[off_index++] : ons[on_index++];
+        events[i] = event;
 
-        append_delta_time(data, size, event.tick - current_tick);
+        events_size += delta_time_size(event.tick - current_tick) + NOTE_MESSAGE_SIZE;
         current_tick = event.tick;
+    }
+    free(ons);
 
-        if (event.is_on) {
-            append_note_on(data, size, event.key, event.velocity);
-        } else {
-            append_note_off(data, size, event.key, event.velocity);
-        }
+    reserve_midi_buffer(buffer, TRACK_CHUNK_START + events_size + END_OF_TRACK_SIZE);
+    append_string(buffer, "MTrk");
+    append_uint32(buffer, events_size + END_OF_TRACK_SIZE);
+
+    current_tick = 0;
+    for (int i = 0; i < count * 2; i++) {
+        append_delta_time(buffer, events[i].tick - current_tick);
+        append_note_event(buffer, events[i], i > 0);
+        current_tick = events[i].tick;
     }
+    append_end_of_track(buffer);
+    free(events);
 }
 
-static void append_track_chunk_start(void *data, int *size, int *chunk_size, int *length_position) {
-    append_string(data, size, "MTrk");
+static void *midi_worker(void *argument) {
+    MidiJob *job = argument;
 
-    // reserve chunk length (4 bytes) to set later
-    *length_position = *size;
-    append_byte(data, size, 0);
-    append_byte(data, size, 0);
-    append_byte(data, size, 0);
-    append_byte(data, size, 0);
+    while (true) {
+        int octave = atomic_fetch_add(&job->next_track, 1);
+        if (octave >= MIDI_NOTE_TRACKS_COUNT)  break;
 
-    *chunk_size = *size;
+        int start = job->octave_starts[octave];
+        int count = job->octave_starts[octave + 1] - start;
+        if (count > 0)  append_note_track(&job->tracks[octave], job->notes, job->positions + start, count);
+    }
+    return NULL;
 }
 
-static void append_track_chunk_end(void *data, int *size, int chunk_start, int length_position) {
-    append_byte(data, size, 0xff);
-    append_byte(data, size, 0x2f);
-    append_byte(data, size, 0);
+static void run_midi_job(MidiJob *job, int threads_count) {
+    if (threads_count <= 1) {
+        midi_worker(job);
+        return;
+    }
 
-    // finally set chunk length
-    uint8_t* pointer = (uint8_t*)data + length_position;
-    uint32_t length_value = (uint32_t) (*size - chunk_start);
-    uint32_t value = le_to_be(length_value);
-    memcpy((int*)pointer, &value, 4);
+    pthread_t threads[MIDI_NOTE_TRACKS_COUNT];
+    int started_count = 0;
+    while (started_count < threads_count) {
+        if (pthread_create(&threads[started_count], NULL, midi_worker, job) != 0)  break;
+        started_count++;
+    }
+    // out of threads, this one takes the share of the ones that did not start
+    if (started_count < threads_count) {
+        midi_worker(job);
+    }
+    for (int i = 0; i < started_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
 }
 
-static void write_data(const char* filename, void* data, int size) {
+static bool write_data(const char* filename, void* data, int size) {
     if (size == 0) {
         printf("Warning! There is no midi data to write to the file %s\n", filename);
-        return;
+        return false;
     }
 
     FILE* file = fopen(filename, "wb");
     
     if (file == NULL) {
         printf("Error opening file %s.\n", filename);
-        return;
+        return false;
     }
 
-    fwrite(data, 1, size, file);
-    fclose(file);
+    // a full disk can show up in fwrite or only when fclose flushes
+    bool success = fwrite(data, 1, size, file) == (size_t) size;
+    success = fclose(file) == 0 && success;
+    if (!success) {
+        printf("Error writing file %s.\n", filename);
+        return false;
+    }
     printf("Written %d bytes to %s.\n", size, filename);
+    return true;
 }
 
-void save_notes_midi_file(Note *notes, int notes_count) {
-    int size = 0;
-    void *data = malloc(notes_count * sizeof(NoteEvent) + 100);
+void *create_midi_data(const NoteStore *notes, int threads_count, int *size) {
+    MidiJob job = { .notes = notes };
+    atomic_init(&job.next_track, 0);
+    job.positions = malloc(sizeof(int) * (notes->notes_count - notes->deleted_count) + 1);
+    assert(job.positions != NULL && "Buy more RAM lol");
+
+    // counting sort of the positions by octave keeps every octave in start_tick order
+    int octave_counts[MIDI_NOTE_TRACKS_COUNT] = { 0 };
+    for (int i = 0; i < notes->notes_count; i++) {
+        const Note *note = note_at(notes, i);
+        if (!note->is_deleted)  octave_counts[(note->key & 0x7F) / MIDI_KEYS_PER_TRACK]++;
+    }
+    int tracks_count = 1;
+    for (int octave = 0; octave < MIDI_NOTE_TRACKS_COUNT; octave++) {
+        job.octave_starts[octave + 1] = job.octave_starts[octave] + octave_counts[octave];
+        if (octave_counts[octave] > 0)  tracks_count++;
+    }
+    int octave_positions[MIDI_NOTE_TRACKS_COUNT];
+    memcpy(octave_positions, job.octave_starts, sizeof(octave_positions));
+    for (int i = 0; i < notes->notes_count; i++) {
+        const Note *note = note_at(notes, i);
+        if (!note->is_deleted)  job.positions[octave_positions[(note->key & 0x7F) / MIDI_KEYS_PER_TRACK]++] = i;
+    }
 
-    append_header(data, &size);
+    run_midi_job(&job, fmax(1, fmin(threads_count, tracks_count - 1)));
+    free(job.positions);
 
-    int chunk_size, length_position;
-    append_track_chunk_start(data, &size, &chunk_size, &length_position);
-    append_events_from_notes(data, &size, notes, notes_count);
-    append_track_chunk_end(data, &size, chunk_size, length_position);
+    int file_size = HEADER_CHUNK_SIZE + TEMPO_TRACK_SIZE;
+    for (int octave = 0; octave < MIDI_NOTE_TRACKS_COUNT; octave++) {
+        file_size += job.tracks[octave].size;
+    }
 
-    write_data("1.mid", data, size);
+    MidiBuffer buffer = { 0 };
+    reserve_midi_buffer(&buffer, file_size);
+    append_header(&buffer, tracks_count);
+    append_tempo_track(&buffer);
+    for (int octave = 0; octave < MIDI_NOTE_TRACKS_COUNT; octave++) {
+        MidiBuffer *track = &job.tracks[octave];
+        memcpy(buffer.data + buffer.size, track->data, track->size);
+        buffer.size += track->size;
+        free_midi_buffer(track);
+    }
+    assert(buffer.size == file_size && "Midi size precomputed wrong");
 
+    *size = buffer.size;
+    return buffer.data;
+}
+
+bool save_notes_midi_file(const NoteStore *notes, int threads_count, const char *filename) {
+    int size;
+    void *data = create_midi_data(notes, threads_count, &size);
+    bool success = write_data(filename, data, size);
     free(data);
+    return success;
+}
+
+// READING
+
+typedef struct {
+    const uint8_t *data;
+    const uint8_t *end;
+    uint64_t source_tick;    // absolute tick of the track being read, in the file's resolution
+    uint64_t ticks_scale;    // tick * ticks_scale / ticks_divisor is our tick
+    uint64_t ticks_divisor;
+    Note *notes;
+    int notes_count;
+    int notes_capacity;
+    const char *error;
+} MidiReader;
+
+// a key held on a channel, start is in our ticks
+typedef struct {
+    uint32_t start_tick;
+    uint8_t velocity;
+    bool is_held;
+} HeldKey;
+
+static inline uint32_t read_uint32(const uint8_t *bytes) {
+    return (uint32_t) bytes[0] << 24 | (uint32_t) bytes[1] << 16 | (uint32_t) bytes[2] << 8 | bytes[3];
+}
+
+static inline uint16_t read_uint16(const uint8_t *bytes) {
+    return (uint16_t)(bytes[0] << 8 | bytes[1]);
+}
+
+// most deltas fit a byte, longer ones are at most 4 bytes
+static inline bool read_delta_time(MidiReader *reader, uint32_t *value) {
+    const uint8_t *data = reader->data;
+    if (data < reader->end && *data < 0x80) {
+        *value = *data;
+        reader->data = data + 1;
+        return true;
+    }
+
+    uint32_t result = 0;
+    for (int i = 0; i < 4 && data < reader->end; i++) {
+        uint8_t byte = *data++;
+        result = result << 7 | (byte & 0x7F);
+        if (byte < 0x80) {
+            *value = result;
+            reader->data = data;
+            return true;
+        }
+    }
+    reader->error = "bad variable length quantity";
+    return false;
+}
+
+static uint32_t scale_tick(MidiReader *reader, uint64_t tick) {
+    uint64_t scaled = (tick * reader->ticks_scale + reader->ticks_divisor / 2) / reader->ticks_divisor;
+    return scaled > UINT32_MAX ? UINT32_MAX : (uint32_t) scaled;
+}
+
+static void end_held_key(MidiReader *reader, HeldKey *held, uint8_t key) {
+    if (!held->is_held)  return;
+    held->is_held = false;
+
+    if (reader->notes_count == reader->notes_capacity) {
+        reader->notes_capacity = reader->notes_capacity == 0 ? 1024 : reader->notes_capacity * 2;
+        reader->notes = realloc(reader->notes, sizeof(Note) * reader->notes_capacity);
+        assert(reader->notes != NULL && "Buy more RAM lol");
+    }
+
+    // a note has to last at least a tick
+    uint32_t end_tick = scale_tick(reader, reader->source_tick);
+    if (end_tick <= held->start_tick)  end_tick = held->start_tick + 1;
+    reader->notes[reader->notes_count++] = (Note) {
+        .key = key,
+        .velocity = held->velocity,
+        .start_tick = held->start_tick,
+        .end_tick = end_tick,
+    };
+}
+
+// one pass over the events of a track chunk, only note ons and offs are kept
+static bool read_track(MidiReader *reader) {
+    HeldKey held_keys[16][128] = { 0 };
+    uint8_t running_status = 0;
+    reader->source_tick = 0;
+
+    while (reader->data < reader->end) {
+        uint32_t delta;
+        if (!read_delta_time(reader, &delta))  return false;
+        reader->source_tick += delta;
+        if (reader->data == reader->end)  break;
+
+        uint8_t status = *reader->data;
+        if (status >= 0x80) {
+            reader->data++;
+        } else if (running_status == 0) {
+            reader->error = "data byte without a status";
+            return false;
+        } else {
+            status = running_status;
+        }
+
+        if (status == 0xFF || status == 0xF0 || status == 0xF7) { // meta and sysex events cancel running status
+            running_status = 0;
+            if (status == 0xFF) {
+                if (reader->data == reader->end)  break;
+                uint8_t type = *reader->data++;
+                if (type == 0x2F)  break; // end of track
+            }
+            uint32_t length;
+            if (!read_delta_time(reader, &length))  return false;
+            if (length > (size_t)(reader->end - reader->data)) {
+                reader->error = "event runs past the end of its track";
+                return false;
+            }
+            reader->data += length;
+            continue;
+        }
+        if (status >= 0xF0) {
+            reader->error = "unexpected system message";
+            return false;
+        }
+
+        running_status = status;
+        uint8_t type = status & 0xF0;
+        int data_size = type == 0xC0 || type == 0xD0 ? 1 : 2;
+        if (reader->end - reader->data < data_size) {
+            reader->error = "event runs past the end of its track";
+            return false;
+        }
+        const uint8_t *bytes = reader->data;
+        reader->data += data_size;
+        if (type != 0x90 && type != 0x80)  continue;
+
+        uint8_t key = bytes[0] & 0x7F;
+        uint8_t velocity = bytes[1] & 0x7F;
+        HeldKey *held = &held_keys[status & 0x0F][key];
+        end_held_key(reader, held, key); // a note on with velocity 0 is a note off
+        if (type == 0x90 && velocity > 0) {
+            *held = (HeldKey) { scale_tick(reader, reader->source_tick), velocity, true };
+        }
+    }
+
+    // keys never released end with the track
+    for (int channel = 0; channel < 16; channel++) {
+        for (int key = 0; key < 128; key++) {
+            end_held_key(reader, &held_keys[channel][key], key);
+        }
+    }
+    return true;
+}
+
+static bool read_chunks(MidiReader *reader) {
+    if (reader->end - reader->data < HEADER_CHUNK_SIZE || memcmp(reader->data, "MThd", 4) != 0) {
+        reader->error = "not a midi file";
+        return false;
+    }
+
+    uint32_t header_length = read_uint32(reader->data + 4);
+    uint16_t format = read_uint16(reader->data + 8);
+    uint16_t division = read_uint16(reader->data + 12);
+    if (format > 1) {
+        reader->error = "only format 0 and 1 files are supported";
+        return false;
+    }
+    if (header_length < 6 || header_length > (size_t)(reader->end - reader->data) - 8) {
+        reader->error = "bad header chunk";
+        return false;
+    }
+
+    if (division & 0x8000) { // frames per second and ticks per frame, taken at the default 120 bpm
+        int frames_per_second = -(int8_t)(division >> 8);
+        reader->ticks_scale = MIDI_TICKS_PER_QUARTER * 2;
+        reader->ticks_divisor = (uint64_t) frames_per_second * (division & 0xFF);
+    } else {
+        reader->ticks_scale = MIDI_TICKS_PER_QUARTER;
+        reader->ticks_divisor = division;
+    }
+    if (reader->ticks_divisor == 0) {
+        reader->error = "bad timing resolution";
+        return false;
+    }
+    reader->data += 8 + header_length;
+
+    // unknown chunks are skipped, a track cut short by the end of the file is read as far as it goes
+    const uint8_t *file_end = reader->end;
+    while (file_end - reader->data >= TRACK_CHUNK_START) {
+        bool is_track = memcmp(reader->data, "MTrk", 4) == 0;
+        uint32_t length = read_uint32(reader->data + 4);
+        reader->data += TRACK_CHUNK_START;
+        const uint8_t *chunk_end = length > (size_t)(file_end - reader->data) ? file_end : reader->data + length;
+
+        if (is_track) {
+            reader->end = chunk_end;
+            bool success = read_track(reader);
+            reader->end = file_end;
+            if (!success)  return false;
+        }
+        reader->data = chunk_end;
+    }
+    return true;
+}
+
+// stable LSD radix sort by start_tick, like radix_sort_note_events
+static void radix_sort_notes(Note *notes, Note *temp, int count) {
+    int histograms[4][256] = { 0 };
+    for (int i = 0; i < count; i++) {
+        uint32_t tick = notes[i].start_tick;
+        histograms[0][tick & 0xff]++;
+        histograms[1][(tick >> 8) & 0xff]++;
+        histograms[2][(tick >> 16) & 0xff]++;
+        histograms[3][tick >> 24]++;
+    }
+
+    Note *source = notes;
+    Note *destination = temp;
+    for (int pass = 0; pass < 4; pass++) {
+        int *histogram = histograms[pass];
+        int shift = pass * 8;
+        if (count == 0 || histogram[(source[0].start_tick >> shift) & 0xff] == count)  continue;
+
+        int offset = 0;
+        for (int byte = 0; byte < 256; byte++) {
+            int byte_count = histogram[byte];
+            histogram[byte] = offset;
+            offset += byte_count;
+        }
+        for (int i = 0; i < count; i++) {
+            destination[histogram[(source[i].start_tick >> shift) & 0xff]++] = source[i];
+        }
+
+        Note *swap = source;
+        source = destination;
+        destination = swap;
+    }
+
+    if (source != notes)  memcpy(notes, source, sizeof(Note) * count);
+}
+
+Note *read_midi_notes(const char *filename, int *notes_count) {
+    int file = open(filename, O_RDONLY);
+    if (file < 0) {
+        printf("Error opening file %s.\n", filename);
+        return NULL;
+    }
+
+    struct stat file_stat;
+    if (fstat(file, &file_stat) != 0 || file_stat.st_size == 0) {
+        printf("Error reading midi file %s: empty file.\n", filename);
+        close(file);
+        return NULL;
+    }
+
+    // the file is only read once from start to end, the kernel can read ahead and drop pages behind
+    size_t file_size = file_stat.st_size;
+    void *data = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (data == MAP_FAILED) {
+        printf("Error mapping file %s.\n", filename);
+        return NULL;
+    }
+    madvise(data, file_size, MADV_SEQUENTIAL);
+
+    MidiReader reader = {
+        .data = data,
+        .end = (const uint8_t *) data + file_size,
+    };
+    bool success = read_chunks(&reader);
+    munmap(data, file_size);
+
+    if (!success) {
+        printf("Error reading midi file %s: %s.\n", filename, reader.error);
+        free(reader.notes);
+        return NULL;
+    }
+
+    // notes were added as they ended and track after track
+    Note *temp = malloc(sizeof(Note) * reader.notes_count + 1);
+    assert(temp != NULL && "Buy more RAM lol");
+    radix_sort_notes(reader.notes, temp, reader.notes_count);
+    free(temp);
+
+    printf("Read %d notes from %s.\n", reader.notes_count, filename);
+    *notes_count = reader.notes_count;
+    return reader.notes;
 }
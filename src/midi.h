@@ -1,3 +1,37 @@
+#ifndef MIDI_INCLUDES
+#define MIDI_INCLUDES
+
 #include "shared.h"
+#include "notes.h"
+
+#define MIDI_TICKS_PER_QUARTER 0x60 // resolution of the files we write, imported ticks are rescaled to it
+#define MIDI_KEYS_PER_TRACK    12   // exported files have a track per octave
+#define MIDI_NOTE_TRACKS_COUNT ((128 + MIDI_KEYS_PER_TRACK - 1) / MIDI_KEYS_PER_TRACK)
+
+// bytes of a midi file being written, grows as it's appended to
+typedef struct {
+    uint8_t *data;
+    int size;
+    int capacity;
+} MidiBuffer;
+
+// makes room for count more bytes, writers reserve the exact size they need up front
+void reserve_midi_buffer(MidiBuffer *buffer, int count);
+void free_midi_buffer(MidiBuffer *buffer);
+
+// whole format 1 file in memory, has to be freed, deleted notes are skipped
+// a tempo track then a track per octave that has notes, tracks are encoded on up to threads_count threads
+void *create_midi_data(const NoteStore *notes, int threads_count, int *size);
+// false when the file could not be opened or fully written
+bool save_notes_midi_file(const NoteStore *notes, int threads_count, const char *filename);
+
+// notes of a format 0 or 1 file sorted by start_tick, has to be freed, NULL when the file can't be read
+// a note on is paired with the next note off of its channel and key, a note on while the key
+// is still held ends the held note, tempo changes are ignored (ticks are only rescaled)
+Note *read_midi_notes(const char *filename, int *notes_count);
+
+// variable length quantity, 1 to 5 bytes
+int delta_time_size(uint32_t ticks);
+void append_delta_time(MidiBuffer *buffer, uint32_t ticks);
 
-void save_notes_midi_file(Note *notes, int notes_count);
+#endif // MIDI_INCLUDES
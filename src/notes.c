@@ -0,0 +1,221 @@
+#include <stdbool.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "notes.h"
+
+// NOTE STORE
+
+void add_note(NoteStore *store, Note note) {
+    int chunk = store->notes_count >> NOTE_CHUNK_BITS;
+    if (chunk == store->chunks_count) {
+        if (store->chunks_count == store->chunks_capacity) {
+            store->chunks_capacity = store->chunks_capacity == 0 ? 16 : store->chunks_capacity * 2;
+            store->chunks = realloc(store->chunks, sizeof(NoteChunk *) * store->chunks_capacity);
+            assert(store->chunks != NULL && "Buy more RAM lol");
+        }
+        store->chunks[store->chunks_count] = malloc(sizeof(NoteChunk));
+        assert(store->chunks[store->chunks_count] != NULL && "Buy more RAM lol");
+        store->chunks_count += 1;
+    }
+
+    int position = store->notes_count++;
+    *note_at(store, position) = note;
+    if (note.is_deleted)  store->deleted_count += 1;
+}
+
+void delete_note(NoteStore *store, int position) {
+    Note *note = note_at(store, position);
+    if (note->is_deleted)  return;
+    note->is_deleted = true;
+    store->deleted_count += 1;
+}
+
+void clear_note_store(NoteStore *store) {
+    store->notes_count = 0;
+    store->deleted_count = 0;
+}
+
+void compact_note_store(NoteStore *store) {
+    if (store->deleted_count == 0)  return;
+
+    int kept_count = 0;
+    for (int position = 0; position < store->notes_count; position++) {
+        Note note = *note_at(store, position);
+        if (note.is_deleted)  continue;
+
+        if (kept_count != position)  *note_at(store, kept_count) = note;
+        kept_count += 1;
+    }
+    store->notes_count = kept_count;
+    store->deleted_count = 0;
+
+    // keeps one spare chunk so deleting and adding around a chunk boundary doesn't allocate every time
+    int used_chunks_count = (kept_count + NOTE_CHUNK_SIZE - 1) >> NOTE_CHUNK_BITS;
+    while (store->chunks_count > used_chunks_count + 1) {
+        free(store->chunks[--store->chunks_count]);
+    }
+}
+
+bool should_compact_note_store(const NoteStore *store) {
+    return store->deleted_count >= NOTE_CHUNK_SIZE && store->deleted_count * 4 >= store->notes_count;
+}
+
+void free_note_store(NoteStore *store) {
+    for (int chunk = 0; chunk < store->chunks_count; chunk++) {
+        free(store->chunks[chunk]);
+    }
+    free(store->chunks);
+    *store = (NoteStore) { 0 };
+}
+
+// GENERATOR
+
+// same numbers raylib's GetRandomValue(0, 100000) gives, without needing raylib
+static double random_value() {
+    double value = (double)(rand() % 100001) / 100000;
+    return value;
+}
+
+void generate_notes(NoteStore *store, unsigned int seed, int notes_count) {
+    srand(seed);
+    clear_note_store(store);
+
+    uint32_t current_tick = 0;
+
+    double base_velocity = 80;
+    double base_key = 80;
+    double base_note_duration = 100;
+
+    /* double wave1_random = 20 * random_value(); */
+    double wave2_random = 15 * random_value();
+    double wave3_random = 100 * random_value();
+
+    double delay = 15;
+
+    for (double i = 0; i < notes_count; i++) {
+        /* double wave1 = cos(i / wave1_random) * 60 * random_value(); */
+        double wave2 = sin(i / wave2_random) * 40 * random_value();
+        double wave3 = sin(i / wave3_random) * 10 * random_value();
+
+        // keys go down from 79 and start over after 64 notes
+        uint8_t key = base_key - 1 - fmod(i, 64); // (uint8_t) (base_key - wave1);
+        uint8_t velocity = (uint8_t) (base_velocity - wave2);
+        uint8_t note_duration = (uint8_t) (base_note_duration - wave3);
+
+        add_note(store, (Note) {
+            .key = key,
+            .velocity = velocity,
+            .start_tick = current_tick + delay,
+            .end_tick = delay + current_tick + note_duration,
+            .is_selected = false,
+            .is_deleted = false
+        });
+
+        current_tick += note_duration + delay;
+    }
+}
+
+void replace_notes(NoteStore *store, const Note *notes, int notes_count) {
+    clear_note_store(store);
+    for (int i = 0; i < notes_count; i++) {
+        add_note(store, notes[i]);
+    }
+}
+
+// NOTE INDEX
+
+void build_note_index(NoteIndex *index, const NoteStore *notes) {
+    int notes_count = notes->notes_count;
+    uint32_t last_end_tick = 0;
+    for (int i = 0; i < notes_count; i++) {
+        Note *note = note_at(notes, i);
+        assert((i == 0 || note_at(notes, i - 1)->start_tick <= note->start_tick) && "Notes have to be sorted by start_tick.");
+        if (note->end_tick > last_end_tick)  last_end_tick = note->end_tick;
+    }
+
+    index->notes_count = notes_count;
+    index->end_tick = last_end_tick;
+    index->buckets_count = last_end_tick / NOTE_INDEX_BUCKET_TICKS + 1;
+    index->bucket_first_notes = realloc(index->bucket_first_notes, sizeof(int) * index->buckets_count);
+    assert(index->bucket_first_notes != NULL && "Buy more RAM lol");
+
+    int note = 0;
+    for (int bucket = 0; bucket < index->buckets_count; bucket++) {
+        uint32_t bucket_tick = bucket * NOTE_INDEX_BUCKET_TICKS;
+        while (note < notes_count && note_at(notes, note)->start_tick < bucket_tick)  note++;
+        index->bucket_first_notes[bucket] = note;
+    }
+
+    // a note is carried by every bucket starting after its start_tick and before its end_tick,
+    // counted first so the lists are packed into one array
+    index->bucket_carried_starts = realloc(index->bucket_carried_starts, sizeof(int) * (index->buckets_count + 1));
+    assert(index->bucket_carried_starts != NULL && "Buy more RAM lol");
+    memset(index->bucket_carried_starts, 0, sizeof(int) * (index->buckets_count + 1));
+
+    for (int i = 0; i < notes_count; i++) {
+        Note *note = note_at(notes, i);
+        if (note->end_tick == 0)  continue;
+        for (int bucket = note->start_tick / NOTE_INDEX_BUCKET_TICKS + 1; bucket <= (int) ((note->end_tick - 1) / NOTE_INDEX_BUCKET_TICKS); bucket++) {
+            index->bucket_carried_starts[bucket + 1]++;
+        }
+    }
+    for (int bucket = 0; bucket < index->buckets_count; bucket++) {
+        index->bucket_carried_starts[bucket + 1] += index->bucket_carried_starts[bucket];
+    }
+
+    int carried_notes_count = index->bucket_carried_starts[index->buckets_count];
+    if (carried_notes_count > index->carried_notes_capacity) {
+        index->carried_notes_capacity = carried_notes_count;
+        index->carried_notes = realloc(index->carried_notes, sizeof(int) * carried_notes_count);
+        assert(index->carried_notes != NULL && "Buy more RAM lol");
+    }
+
+    // bucket_carried_starts[b] is the fill position of bucket b, a full bucket ends where the next one starts
+    // so shifting them back one bucket afterwards gives the starts again
+    for (int i = 0; i < notes_count; i++) {
+        Note *note = note_at(notes, i);
+        if (note->end_tick == 0)  continue;
+        for (int bucket = note->start_tick / NOTE_INDEX_BUCKET_TICKS + 1; bucket <= (int) ((note->end_tick - 1) / NOTE_INDEX_BUCKET_TICKS); bucket++) {
+            index->carried_notes[index->bucket_carried_starts[bucket]++] = i;
+        }
+    }
+    for (int bucket = index->buckets_count; bucket > 0; bucket--) {
+        index->bucket_carried_starts[bucket] = index->bucket_carried_starts[bucket - 1];
+    }
+    index->bucket_carried_starts[0] = 0;
+}
+
+void free_note_index(NoteIndex *index) {
+    free(index->bucket_first_notes);
+    free(index->bucket_carried_starts);
+    free(index->carried_notes);
+    *index = (NoteIndex) { 0 };
+}
+
+void find_notes_in_ticks(NoteIndex *index, const NoteStore *notes, uint32_t start_tick, uint32_t end_tick,
+                         const int **carried_notes, int *carried_count, int *first_note, int *last_note) {
+    int bucket = start_tick / NOTE_INDEX_BUCKET_TICKS;
+    if (bucket < index->buckets_count) {
+        *first_note = index->bucket_first_notes[bucket];
+        *carried_notes = &index->carried_notes[index->bucket_carried_starts[bucket]];
+        *carried_count = index->bucket_carried_starts[bucket + 1] - index->bucket_carried_starts[bucket];
+    } else {
+        *first_note = index->notes_count;
+        *carried_notes = NULL;
+        *carried_count = 0;
+    }
+
+    // first note starting at or after end_tick
+    int low = *first_note;
+    int high = index->notes_count;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (note_at(notes, middle)->start_tick < end_tick)  low = middle + 1;
+        else  high = middle;
+    }
+    *last_note = low;
+}
@@ -0,0 +1,78 @@
+#ifndef NOTES_INCLUDES
+#define NOTES_INCLUDES
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "shared.h"
+
+#define NOTE_INDEX_BUCKET_TICKS 128
+#define NOTE_CHUNK_BITS         12
+#define NOTE_CHUNK_SIZE         (1 << NOTE_CHUNK_BITS) // notes per chunk, chunks never move once allocated
+#define GENERATED_NOTES_COUNT   31 // what the Generate button makes
+
+typedef struct {
+    Note notes[NOTE_CHUNK_SIZE];
+} NoteChunk;
+
+// notes in positions [0, notes_count), spread over chunks of NOTE_CHUNK_SIZE
+// deleted notes keep their position (is_deleted) until the store is compacted
+// what belongs to a note (is_selected) lives in it and moves along, positions are never kept across compaction
+typedef struct {
+    NoteChunk **chunks;
+    int chunks_count;
+    int chunks_capacity;
+    int notes_count; // deleted notes included
+    int deleted_count;
+} NoteStore;
+
+// notes sorted by start_tick, bucketed by tick: a bucket points to the first note starting in it or later,
+// notes that started before the bucket and still sound at its start are listed per bucket (carried notes),
+// so one long note only adds itself to the buckets it covers, notes after the window are found by binary search
+typedef struct {
+    int *bucket_first_notes;
+    int *bucket_carried_starts; // bucket b carries carried_notes[bucket_carried_starts[b], bucket_carried_starts[b + 1])
+    int *carried_notes;
+    int carried_notes_capacity;
+    int buckets_count;
+    int notes_count;
+    uint32_t end_tick; // latest end_tick of any note, the song ends there (notes from files can end after the last one)
+} NoteIndex;
+
+static inline Note *note_at(const NoteStore *store, int position) {
+    return &store->chunks[position >> NOTE_CHUNK_BITS]->notes[position & (NOTE_CHUNK_SIZE - 1)];
+}
+
+// appends a note after the last position, the store grows by a chunk when it's full
+void add_note(NoteStore *store, Note note);
+
+// marks a note deleted, it keeps its position until compact_note_store
+void delete_note(NoteStore *store, int position);
+
+// removes every note, chunks are kept for the next notes
+void clear_note_store(NoteStore *store);
+
+// moves the remaining notes over the deleted ones keeping their order, frees chunks left empty
+void compact_note_store(NoteStore *store);
+
+// deleted notes are worth compacting away: at least a chunk of them and a quarter of the store
+bool should_compact_note_store(const NoteStore *store);
+
+void free_note_store(NoteStore *store);
+
+// replaces the notes with a random melody, the same seed makes the same notes
+void generate_notes(NoteStore *store, unsigned int seed, int notes_count);
+
+// replaces the notes with copies of notes (read from a file), they have to be sorted by start_tick
+void replace_notes(NoteStore *store, const Note *notes, int notes_count);
+
+// notes have to be sorted by start_tick, deleted notes stay in the index
+void build_note_index(NoteIndex *index, const NoteStore *notes);
+void free_note_index(NoteIndex *index);
+
+// the carried notes plus notes [*first_note, *last_note) contain every note overlapping [start_tick, end_tick),
+// they still have to be checked one by one
+void find_notes_in_ticks(NoteIndex *index, const NoteStore *notes, uint32_t start_tick, uint32_t end_tick,
+                         const int **carried_notes, int *carried_count, int *first_note, int *last_note);
+
+#endif // NOTES_INCLUDES
@@ -0,0 +1,129 @@
+#include <stdbool.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "shared.h"
+#include "peaks.h"
+
+static PeakBlock empty_block(void) {
+    return (PeakBlock) { INFINITY, -INFINITY, 0 };
+}
+
+static PeakBlock merge_blocks(PeakBlock a, PeakBlock b) {
+    return (PeakBlock) {
+        fminf(a.min, b.min),
+        fmaxf(a.max, b.max),
+        a.sum_squares + b.sum_squares
+    };
+}
+
+static PeakBlock sample_block(const float *samples, uint32_t frame) {
+    float value = samples[(size_t) frame * NUMBER_OF_CHANNELS];
+    return (PeakBlock) { value, value, value * value };
+}
+
+static PeakBlock summarize_frames(const float *samples, uint32_t start_frame, uint32_t end_frame) {
+    float min = INFINITY;
+    float max = -INFINITY;
+    float sum_squares = 0;
+
+    for (uint32_t frame = start_frame; frame < end_frame; frame++) {
+        float value = samples[(size_t) frame * NUMBER_OF_CHANNELS];
+        min = value < min ? value : min;
+        max = value > max ? value : max;
+        sum_squares += value * value;
+    }
+    return (PeakBlock) { min, max, sum_squares };
+}
+
+// frames covered by a block, the last one of a level can be partial
+static uint32_t block_frames(const WaveformPeaks *peaks, int level, uint32_t start_frame) {
+    uint64_t size = (uint64_t) 1 << (PEAKS_BLOCK_BITS + level);
+    return fmin(size, peaks->frames_count - start_frame);
+}
+
+static void update_block(WaveformPeaks *peaks, const float *samples, int level, uint32_t index) {
+    if (level == 0) {
+        uint32_t start_frame = index << PEAKS_BLOCK_BITS;
+        peaks->levels[0][index] = summarize_frames(samples, start_frame, start_frame + block_frames(peaks, 0, start_frame));
+        return;
+    }
+
+    PeakBlock *children = peaks->levels[level - 1];
+    PeakBlock block = children[index * 2];
+    if (index * 2 + 1 < peaks->level_sizes[level - 1])  block = merge_blocks(block, children[index * 2 + 1]);
+    peaks->levels[level][index] = block;
+}
+
+void build_waveform_peaks(WaveformPeaks *peaks, const float *samples, uint32_t frames_count) {
+    peaks->frames_count = frames_count;
+    peaks->levels_count = 0;
+    if (frames_count == 0)  return;
+
+    // every level halves the previous one, down to a single block
+    size_t blocks_count = 0;
+    uint32_t level_size = (frames_count + (1u << PEAKS_BLOCK_BITS) - 1) >> PEAKS_BLOCK_BITS;
+    while (true) {
+        assert(peaks->levels_count < PEAKS_LEVELS_CAPACITY);
+        peaks->level_sizes[peaks->levels_count++] = level_size;
+        blocks_count += level_size;
+        if (level_size == 1)  break;
+        level_size = (level_size + 1) / 2;
+    }
+
+    PeakBlock *blocks = realloc(peaks->levels[0], sizeof(PeakBlock) * blocks_count);
+    assert(blocks != NULL && "Buy more RAM lol");
+    for (int level = 0; level < peaks->levels_count; level++) {
+        peaks->levels[level] = blocks;
+        blocks += peaks->level_sizes[level];
+    }
+
+    update_waveform_peaks(peaks, samples, 0, frames_count);
+}
+
+void update_waveform_peaks(WaveformPeaks *peaks, const float *samples, uint32_t start_frame, uint32_t end_frame) {
+    end_frame = fmin(end_frame, peaks->frames_count);
+    if (start_frame >= end_frame)  return;
+
+    uint32_t first = start_frame >> PEAKS_BLOCK_BITS;
+    uint32_t last = (end_frame - 1) >> PEAKS_BLOCK_BITS;
+    for (int level = 0; level < peaks->levels_count; level++) {
+        for (uint32_t index = first; index <= last; index++) {
+            update_block(peaks, samples, level, index);
+        }
+        first /= 2;
+        last /= 2;
+    }
+}
+
+PeakBlock measure_waveform_peaks(const WaveformPeaks *peaks, const float *samples, uint32_t start_frame, uint32_t end_frame) {
+    end_frame = fmin(end_frame, peaks->frames_count);
+    PeakBlock result = empty_block();
+
+    uint32_t frame = start_frame;
+    while (frame < end_frame) {
+        // the biggest block that starts here and ends before end_frame, otherwise a single sample
+        int level = peaks->levels_count - 1;
+        if (frame != 0)  level = fmin(level, __builtin_ctz(frame) - PEAKS_BLOCK_BITS);
+        while (level >= 0 && frame + block_frames(peaks, level, frame) > end_frame)  level--;
+
+        if (level < 0) {
+            result = merge_blocks(result, sample_block(samples, frame));
+            frame += 1;
+            continue;
+        }
+
+        result = merge_blocks(result, peaks->levels[level][frame >> (PEAKS_BLOCK_BITS + level)]);
+        frame += block_frames(peaks, level, frame);
+    }
+
+    if (result.min > result.max)  return (PeakBlock) { 0 };
+    return result;
+}
+
+void free_waveform_peaks(WaveformPeaks *peaks) {
+    free(peaks->levels[0]);
+    *peaks = (WaveformPeaks) { 0 };
+}
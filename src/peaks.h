@@ -0,0 +1,35 @@
+#ifndef PEAKS_INCLUDES
+#define PEAKS_INCLUDES
+
+#include <stdint.h>
+
+#define PEAKS_BLOCK_BITS      4 // first level summarizes 16 frames
+#define PEAKS_LEVELS_CAPACITY 32
+
+typedef struct {
+    float min;
+    float max;
+    float sum_squares;
+} PeakBlock;
+
+// multi-resolution summary of the first channel of interleaved samples:
+// level k has a block for every 2^(PEAKS_BLOCK_BITS + k) frames, the last block of a level can be partial
+typedef struct {
+    uint32_t frames_count;
+    int levels_count;
+    uint32_t level_sizes[PEAKS_LEVELS_CAPACITY];
+    PeakBlock *levels[PEAKS_LEVELS_CAPACITY]; // all levels share one allocation starting at levels[0]
+} WaveformPeaks;
+
+// (re)builds the whole pyramid for frames_count frames
+void build_waveform_peaks(WaveformPeaks *peaks, const float *samples, uint32_t frames_count);
+
+// recomputes blocks covering [start_frame, end_frame) after the samples there changed
+void update_waveform_peaks(WaveformPeaks *peaks, const float *samples, uint32_t start_frame, uint32_t end_frame);
+
+// summary of [start_frame, end_frame), reads whole blocks where it can and samples only at the edges
+PeakBlock measure_waveform_peaks(const WaveformPeaks *peaks, const float *samples, uint32_t start_frame, uint32_t end_frame);
+
+void free_waveform_peaks(WaveformPeaks *peaks);
+
+#endif // PEAKS_INCLUDES
@@ -1,5 +1,6 @@
 #include "raylib.h"
 #include "raymath.h"
+#include "rlgl.h"
 #include "miniaudio.h"
 
 #include <assert.h>
@@ -9,17 +10,53 @@
 #include <string.h>
 #include <math.h>
 #include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include "shared.h"
 #include "midi.h"
 #include "wav.h"
 #include "ui.h"
-
-#define NOTES_LIMIT 10000
-#define FRAMES_PER_TICK (SAMPLE_RATE / 100)
+#include "synth.h"
+#include "peaks.h"
+#include "notes.h"
+#include "ring.h"
+#include "buffer.h"
+#include "profile.h"
+#include "host.h"
+#include "export.h"
+
+#define PLAYBACK_RING_FRAMES 2048 // ~46 ms between the render thread and the device
+#define RENDER_THREAD_ERROR  "Error starting render thread, nothing can be played."
 
 // predeclarations
 void create_waveform_samples(void);
+void update_sound_after_notes_change(bool should_restart_playback);
+void update_waveform_samples(void);
+void mark_dirty_ticks(uint32_t start_tick, uint32_t end_tick);
+
+// decimated points of the zoomed in waveform, x is relative to start_frame so scrolling only moves them
+typedef struct {
+    Vector2 *points;
+    int points_count;
+    int points_capacity;
+
+    // what the points were built for
+    uint32_t start_frame;
+    uint32_t end_frame;
+    float sample_width;
+    float wave_amplitude;
+    float view_y;
+    float view_height;
+    int samples_version;
+} WaveformPolyline;
+
+// the visible notes of a frame, drawn in one batch
+typedef struct {
+    Rectangle *rects;
+    Color *colors;
+    int capacity;
+} NoteRects;
 
 typedef struct {
     Vector2 selection_first_point;
@@ -28,17 +65,51 @@ typedef struct {
     char *error_message;
 
     bool is_displaying_waveform;
-    Note notes[NOTES_LIMIT];
-    int notes_count;
-    float waveform_samples[2048 * NOTES_LIMIT];
+    bool is_showing_profile;
+    Waveform oscillator_waveform;
+    StealPolicy steal_policy;
+    bool is_voice_pool_growable;
+    NoteStore notes; // ui thread only, the render thread plays events made from it (see rebuild_stream_sound_state)
+    NoteIndex note_index; // rebuilt whenever notes are created or compacted
+    SampleBuffer waveform_buffer; // waveform_samples_count frames, committed as the song grows
+    SampleBuffer waveform_render_buffer; // rendered into without stream_lock, then swapped or copied into waveform_buffer
     int waveform_samples_count;
+    VoiceCheckpoints voice_checkpoints; // of the waveform renders, dropped from the dirty ticks on
+    WaveformPeaks waveform_peaks; // zoomed out waveform reads these instead of the samples
+    WaveformPolyline waveform_polyline;
+    NoteRects note_rects;
+    int waveform_samples_version; // changes whenever waveform_samples are rendered
     
-    ma_device audio_device;
-    int playback_sample_counter;
-    bool is_playing_sound;
+    atomic_int playback_sample_counter; // samples heard so far, only plug_audio_callback changes it
+    atomic_bool is_playing_sound;
+
+    // the render thread fills playback_ring with the next blocks of the song and plug_audio_callback only reads from it
+    // streaming mode: blocks are synthesized from the notes, waveform_samples are only rendered on demand
+    // (waveform view, wav export); otherwise they are copied from waveform_samples
+    bool is_streaming_mode;
+    bool is_waveform_outdated;
+    atomic_bool is_render_finished; // everything is in the ring, the song is over once it's played
+    RingBuffer playback_ring;
+    pthread_t render_thread;
+    bool has_render_thread; // render_thread was started and not joined yet
+    atomic_bool should_stop_render_thread;
+    int render_sample_position; // next sample of waveform_samples to copy when not streaming
+
+    // ticks changed by edits since the waveform was rendered, only they are rendered again
+    bool has_dirty_ticks;
+    uint32_t dirty_start_tick;
+    uint32_t dirty_end_tick;
+    bool did_steal_voices; // stealing depends on every earlier note, an edit can change the rest of the song
+
+    // held by the render thread while it makes a block, and by the ui while it changes what blocks are made of
+    ma_mutex stream_lock;
+    SoundState stream_sound_state;
+
+    ExportJob export_job; // one export at a time, from a copy of the notes
 } State;
 
 State *state = NULL;
+AudioMeter *audio_meter = NULL; // owned by the host, set before any other plug_ function runs
 
 // functions
 
@@ -51,48 +122,31 @@ float lerp(float a, float b, float f) {
     return a + f * (b - a);
 }
 
-double random_value() {
-    double value = (double)GetRandomValue(0, 100000) / 100000;
-    return value;
-}
-
 void create_notes() {
-    srand(time(0));
-    state->notes_count = 0;
-
-    uint32_t current_tick = 0;
-
-    double base_velocity = 80;
-    double base_key = 80;
-    double base_note_duration = 100;
-
-    /* double wave1_random = 20 * random_value(); */
-    double wave2_random = 15 * random_value();
-    double wave3_random = 100 * random_value();
-
-    double delay = 15;
+    generate_notes(&state->notes, time(0), GENERATED_NOTES_COUNT);
+    build_note_index(&state->note_index, &state->notes);
+}
 
-    for (double i = 0; i < 31; i++) {
-        /* double wave1 = cos(i / wave1_random) * 60 * random_value(); */
-        double wave2 = sin(i / wave2_random) * 40 * random_value();
-        double wave3 = sin(i / wave3_random) * 10 * random_value();
+// a midi file dropped on the window replaces the notes
+static void load_dropped_midi_file(void) {
+    if (!IsFileDropped())  return;
+
+    FilePathList files = LoadDroppedFiles();
+    const char *path = files.paths[files.count - 1];
+    int notes_count = 0;
+    Note *notes = IsFileExtension(path, ".mid;.midi") ? read_midi_notes(path, &notes_count) : NULL;
+    UnloadDroppedFiles(files);
+    if (notes == NULL || notes_count == 0) {
+        free(notes);
+        return;
+    }
 
-        uint8_t key = --base_key; // (uint8_t) (base_key - wave1);
-        uint8_t velocity = (uint8_t) (base_velocity - wave2);
-        uint8_t note_duration = (uint8_t) (base_note_duration - wave3);
-    
-        state->notes[state->notes_count] = (Note) {
-            .key = key,
-            .velocity = velocity,
-            .start_tick = current_tick + delay,
-            .end_tick = delay + current_tick + note_duration,
-            .is_selected = false,
-            .is_deleted = false
-        };
+    replace_notes(&state->notes, notes, notes_count);
+    build_note_index(&state->note_index, &state->notes);
+    free(notes);
 
-        state->notes_count += 1;
-        current_tick += note_duration + delay;
-    }
+    state->is_waveform_outdated = true;
+    update_sound_after_notes_change(true);
 }
 
 void get_time_string(char *text, int time_milliseconds) { // text must be char[10]
@@ -105,7 +159,8 @@ void get_time_string(char *text, int time_milliseconds) { // text must be char[1
 // USER INTERFACE
 
 void DrawNotes(float view_x, float view_y, float view_width, float view_height) {
-    if (state->notes_count == 0) return;
+    PROFILE_SCOPE(PROFILE_DRAW_NOTES);
+    if (state->notes.notes_count == 0) return;
 
     if (IsMouseButtonPressed(MOUSE_BUTTON_MIDDLE)) {
         state->notes_scroll_zoom_state.target_zoom_x = 0.5f;
@@ -115,7 +170,7 @@ void DrawNotes(float view_x, float view_y, float view_width, float view_height)
 
     float key_height = 3 + state->notes_scroll_zoom_state.zoom_y * 10;
     float tick_width = 0.05 + state->notes_scroll_zoom_state.zoom_x * 3;
-    float content_size = tick_width * state->notes[state->notes_count-1].end_tick; // NOTE: only considering notes are sorted
+    float content_size = tick_width * state->note_index.end_tick;
     assert(content_size > 0);
 
     float scroll_offset = 0;
@@ -177,8 +232,29 @@ void DrawNotes(float view_x, float view_y, float view_width, float view_height)
         state->selection_first_point = Vector2Zero();
     }
 
-    for (int i = 0; i < state->notes_count; i++) {
-        Note note = state->notes[i];
+    const int *carried_notes;
+    int carried_count, first_note, last_note;
+    uint32_t first_visible_tick = fmax(0, scroll_offset / tick_width);
+    uint32_t last_visible_tick = fmax(0, (scroll_offset + view_width) / tick_width + 1);
+    find_notes_in_ticks(&state->note_index, &state->notes, first_visible_tick, last_visible_tick,
+                        &carried_notes, &carried_count, &first_note, &last_note);
+    int candidates_count = carried_count + last_note - first_note;
+
+    // only notes in the visible ticks, their rects are drawn at once
+    NoteRects *note_rects = &state->note_rects;
+    int note_rects_count = 0;
+
+    if (candidates_count > note_rects->capacity) {
+        note_rects->capacity = fmax(1024, candidates_count * 2);
+        note_rects->rects = realloc(note_rects->rects, sizeof(Rectangle) * note_rects->capacity);
+        note_rects->colors = realloc(note_rects->colors, sizeof(Color) * note_rects->capacity);
+        assert(note_rects->rects != NULL && note_rects->colors != NULL && "Buy more RAM lol");
+    }
+
+    // notes that started before the window's bucket, then the ones starting from it
+    for (int candidate = 0; candidate < candidates_count; candidate++) {
+        int i = candidate < carried_count ? carried_notes[candidate] : first_note + candidate - carried_count;
+        Note note = *note_at(&state->notes, i);
         if (note.is_deleted)  continue;
 
         Rectangle note_rect = {
@@ -202,17 +278,27 @@ void DrawNotes(float view_x, float view_y, float view_width, float view_height)
             note_color = note.is_selected ? GREEN : BLACK;
         }
 
-        if (note_clipped_rect.width > 0) {
-            DrawRectangleRec(note_clipped_rect, note_color);
+        if (note_clipped_rect.width > 0 && note_clipped_rect.height > 0) {
+            note_rects->rects[note_rects_count] = note_clipped_rect;
+            note_rects->colors[note_rects_count] = note_color;
+            note_rects_count += 1;
         }
 
         // save selection state on mouse release
         if (IsMouseButtonReleased(MOUSE_BUTTON_LEFT) && is_inside_selection_rect) {
-            state->notes[i].is_selected = !IsKeyDown(KEY_LEFT_CONTROL);
+            note_at(&state->notes, i)->is_selected = !IsKeyDown(KEY_LEFT_CONTROL);
         }
+    }
+    DrawRectangleBatch(note_rects->rects, note_rects->colors, note_rects_count);
+
+    // selected notes can be outside of the view
+    if (IsKeyPressed(KEY_D)) {
+        for (int i = 0; i < state->notes.notes_count; i++) {
+            Note note = *note_at(&state->notes, i);
+            if (note.is_deleted || !note.is_selected)  continue;
 
-        if (IsKeyPressed(KEY_D) && state->notes[i].is_selected) {
-            state->notes[i].is_deleted = true;
+            delete_note(&state->notes, i);
+            mark_dirty_ticks(note.start_tick, note.end_tick);
             did_edit_notes = true;
         }
     }
@@ -233,15 +319,57 @@ void DrawNotes(float view_x, float view_y, float view_width, float view_height)
     DrawText(time_text, view_x + 20, view_y + 20, 20, BLACK);
 
     if (did_edit_notes) {
-        create_waveform_samples();
+        update_sound_after_notes_change(false);
     }
 
     if (DrawButton("Waveform", 100, view_x + view_width - 20 - 160, view_y + 20, 160, 40)) {
+        update_waveform_samples();
         state->is_displaying_waveform = true;
     }
 }
 
+static void add_polyline_point(WaveformPolyline *polyline, uint32_t frame, float value) {
+    if (polyline->points_count == polyline->points_capacity) {
+        polyline->points_capacity = fmax(1024, polyline->points_capacity * 2);
+        polyline->points = realloc(polyline->points, sizeof(Vector2) * polyline->points_capacity);
+        assert(polyline->points != NULL && "Buy more RAM lol");
+    }
+
+    polyline->points[polyline->points_count++] = (Vector2) {
+        (frame - polyline->start_frame) * polyline->sample_width,
+        polyline->view_y + polyline->view_height / 2 - value * polyline->wave_amplitude
+    };
+}
+
+// keeps at most the lowest and the highest sample of every pixel column, in the order they are played
+static void build_waveform_polyline(WaveformPolyline *polyline, uint32_t start_frame, uint32_t end_frame) {
+    polyline->points_count = 0;
+    polyline->start_frame = start_frame;
+    polyline->end_frame = end_frame;
+
+    uint32_t frame = start_frame;
+    while (frame < end_frame) {
+        int64_t column = (int64_t) (frame * (double) polyline->sample_width);
+        uint32_t min_frame = frame;
+        uint32_t max_frame = frame;
+        uint32_t column_end = frame;
+
+        for (; column_end < end_frame && (int64_t) (column_end * (double) polyline->sample_width) == column; column_end++) {
+            float value = state->waveform_buffer.samples[column_end * NUMBER_OF_CHANNELS];
+            if (value < state->waveform_buffer.samples[min_frame * NUMBER_OF_CHANNELS])  min_frame = column_end;
+            if (value > state->waveform_buffer.samples[max_frame * NUMBER_OF_CHANNELS])  max_frame = column_end;
+        }
+
+        uint32_t first = fmin(min_frame, max_frame);
+        uint32_t second = fmax(min_frame, max_frame);
+        add_polyline_point(polyline, first, state->waveform_buffer.samples[first * NUMBER_OF_CHANNELS]);
+        if (second != first)  add_polyline_point(polyline, second, state->waveform_buffer.samples[second * NUMBER_OF_CHANNELS]);
+        frame = column_end;
+    }
+}
+
 void DrawWaveform(float view_x, float view_y, float view_width, float view_height) {
+    PROFILE_SCOPE(PROFILE_DRAW_WAVEFORM);
     if (state->waveform_samples_count == 0)  return;
 
     if (IsMouseButtonPressed(MOUSE_BUTTON_MIDDLE)) {
@@ -275,107 +403,59 @@ void DrawWaveform(float view_x, float view_y, float view_width, float view_heigh
     int draw_calls_count = 0;
     const float min_sample_width_for_precise_wave = 0.1515;
 
-    float right_edge = background_rect.x + background_rect.width;
-    float bottom_edge = background_rect.y + background_rect.height;
-
-    // TODO: can be optimized better by skipping values that can't be on the screen instead of checking all of them
-
     if (sample_width > min_sample_width_for_precise_wave) { // draw actual wave (zoomed in)
         float sample_width_percent = inverse_lerp(min_sample_width_for_precise_wave, 1, sample_width);
         float line_thickness = lerp(2.0, 3.5, sample_width_percent);
-        int skipping_frames = (int) lerp(3, 1, sample_width_percent);
-
-        float previous_value = 0;
-        for (int i = 0; i < state->waveform_samples_count; i++) {
-            float value = state->waveform_samples[i * 2];
-
-            if (i == 0) { // nothing to draw since there is only 1 point yet
-                previous_value = value;
-                continue;
-            }
-
-            if (i % skipping_frames != 0)  continue;
-
-            // draw line
-            float x0 = (i - 1) * sample_width - scroll_offset + view_x;
-            float x1 = i * sample_width - scroll_offset + view_x;
-            float y0 = view_height - (view_height/2 - (-1.0f * previous_value * wave_amplitude)) + view_y;
-            float y1 = view_height - (view_height/2 - (-1.0f * value * wave_amplitude)) + view_y;
-
-            previous_value = value;
-
-            // check if not beyond the bounds
-            if (x1 > right_edge || x0 < view_x)  continue;
-            if ((y0 < view_y && y1 < view_y) || (y0 > bottom_edge && y1 > bottom_edge))  continue;
 
-            Vector2 point1 = (Vector2) {
-                fmax(view_x, x0),
-                fmin(bottom_edge, fmax(view_y, y0))
-            };
-
-            Vector2 point2 = (Vector2) {
-                fmin(right_edge, x1),
-                fmax(view_y, fmin(bottom_edge, y1))
-            };
-
-            DrawLineEx(point1, point2, line_thickness, BLACK);
-            draw_calls_count += 1;
+        // only visible frames, the polyline is rebuilt when the view scrolls past it or anything else changes
+        uint32_t first_frame = fmax(0, scroll_offset / sample_width - 1);
+        uint32_t last_frame = fmin(state->waveform_samples_count, (scroll_offset + view_width) / sample_width + 2);
+        uint32_t margin_frames = view_width / sample_width;
+
+        WaveformPolyline *polyline = &state->waveform_polyline;
+        bool is_polyline_outdated = polyline->samples_version != state->waveform_samples_version
+            || polyline->sample_width != sample_width
+            || polyline->wave_amplitude != wave_amplitude
+            || polyline->view_y != view_y
+            || polyline->view_height != view_height
+            || first_frame < polyline->start_frame
+            || last_frame > polyline->end_frame;
+
+        if (is_polyline_outdated) {
+            polyline->samples_version = state->waveform_samples_version;
+            polyline->sample_width = sample_width;
+            polyline->wave_amplitude = wave_amplitude;
+            polyline->view_y = view_y;
+            polyline->view_height = view_height;
+            build_waveform_polyline(
+                polyline,
+                first_frame > margin_frames ? first_frame - margin_frames : 0,
+                fmin(state->waveform_samples_count, last_frame + margin_frames)
+            );
         }
+
+        // one batch of quads, clipped by the gpu instead of every segment
+        Rectangle clip_rect = GetCollisionRec(background_rect, (Rectangle) { view_x, view_y, view_width, view_height });
+        BeginScissorMode(clip_rect.x, clip_rect.y, clip_rect.width, clip_rect.height);
+        rlPushMatrix();
+        rlTranslatef(polyline->start_frame * sample_width - scroll_offset + view_x, 0, 0);
+        DrawSplineLinear(polyline->points, polyline->points_count, line_thickness, BLACK);
+        rlPopMatrix();
+        EndScissorMode();
+        draw_calls_count += 1;
     } else { // draw zoomed out
         float sample_width_percent = inverse_lerp(0.01, min_sample_width_for_precise_wave, sample_width);
         float expected_sample_width = lerp(4, 2, sample_width_percent);
         float skipping_frames_value = expected_sample_width / sample_width;
         int skipping_frames = (int) skipping_frames_value;
 
-        float highest_value = 0;
-        float sum = 0;
-        for (int i = 0; i < state->waveform_samples_count; i++) {
-            float value = state->waveform_samples[i * 2];
-
-            // collect values in this batch
-            sum += value * value;
-            highest_value = fmax(highest_value, fabs(value));
-            if (i % skipping_frames != 0)  continue;
-
-            int j = i / skipping_frames;
-            float x = (j * skipping_frames - 1) * sample_width - scroll_offset + view_x;
-            float width = sample_width * skipping_frames;
-
-            float height_peak = highest_value * 2 * wave_amplitude;
-            float y_peak = view_y + view_height / 2 - height_peak / 2;
-
-            bool should_draw_rms = sample_width < min_sample_width_for_precise_wave / 3 * 2;
-            float rms_value = sqrt(sum / skipping_frames) * 0.8;
-            float height_rms = rms_value * 2 * wave_amplitude;
-            float y_rms = view_y + view_height / 2 - height_rms / 2;
-
-            // reset values before the next batch
-            highest_value = 0;
-            sum = 0;
-
-            // check if not beyond the bounds
-            if (x > right_edge || (x + width) < view_x)  continue;
-
-            Rectangle peak_rect = (Rectangle) {
-                x,
-                fmin(bottom_edge, fmax(view_y, y_peak)),
-                width,
-                fmin(view_height, height_peak)
-            };
-            DrawRectangleRec(GetCollisionRec(background_rect, peak_rect), BLACK);
-            draw_calls_count += 1;
-
-            if (should_draw_rms) {
-                Rectangle rms_rect = (Rectangle) {
-                    x,
-                    fmin(bottom_edge, fmax(view_y, y_rms)),
-                    width,
-                    fmin(view_height, height_rms)
-                };
-                DrawRectangleRec(GetCollisionRec(background_rect, rms_rect), DARKGRAY);
-                draw_calls_count += 1;
-            }
-        }
+        bool should_draw_rms = sample_width < min_sample_width_for_precise_wave / 3 * 2;
+
+        draw_calls_count += DrawWaveformPeaks(
+            &state->waveform_peaks, state->waveform_buffer.samples, state->waveform_samples_count,
+            (Rectangle) { view_x, view_y, view_width, view_height }, background_rect, scroll_offset,
+            sample_width, skipping_frames, wave_amplitude, should_draw_rms
+        );
     }
 
     // vertical line separator every second (excluding 0)
@@ -418,207 +498,307 @@ void DrawWaveform(float view_x, float view_y, float view_width, float view_heigh
 
 // AUDIO
 
-static float midiNoteToFrequency(uint8_t note) {
-    return powf(2.0f, (note - 69) / 12.0f) * 440.0f;
+static SoundState create_render_sound_state(void) {
+    SoundState data = {
+        .notes = &state->notes,
+        .current_frame = 0,
+        .waveform = state->oscillator_waveform,
+        .voices = { }
+    };
+    init_voice_allocator(&data.allocator, state->steal_policy, state->is_voice_pool_growable);
+    data.checkpoints = &state->voice_checkpoints;
+    create_sound_events(&data);
+    return data;
 }
 
-typedef struct {
-    Note* notes;
-    int notes_count;
-    uint32_t current_frame;
-
-    struct {
-        bool active;
-        bool is_releasing;
-        float phase_accumulator;
-        float frequency;
-        float attack;
-        int identifier;
-    } active_notes[MAX_POLYPHONY];
-} SoundState;
-
-static int note_identifier(Note note) {
-    return 1000000000 + note.start_tick * 1000 + note.key;
+// renders into waveform_render_buffer without stream_lock (only the ui changes the notes),
+// the lock is only held to swap it in: the render thread keeps copying the old samples into the ring meanwhile
+void create_waveform_samples() {
+    PROFILE_SCOPE(PROFILE_CREATE_WAVEFORM);
+    SoundState data = create_render_sound_state();
+    invalidate_voice_checkpoints(&state->voice_checkpoints, 0);
+
+    // compaction can leave no notes at all, the index ends at 0 then
+    uint32_t frames_count = song_frames_count(state->note_index.end_tick);
+    SampleBuffer *rendered = &state->waveform_render_buffer;
+    resize_sample_buffer(rendered, (size_t) frames_count * NUMBER_OF_CHANNELS);
+    bool success = render_samples(rendered->samples, frames_count, &data, render_threads_count());
+
+    ma_mutex_lock(&state->stream_lock);
+    SampleBuffer previous = state->waveform_buffer;
+    state->waveform_buffer = *rendered;
+    state->waveform_samples_count = success ? frames_count : 0;
+    state->waveform_samples_version += 1;
+    state->error_message = data.error_message;
+    ma_mutex_unlock(&state->stream_lock);
+
+    // the old samples are only needed again as the target of the next render, their pages are given back
+    *rendered = previous;
+    resize_sample_buffer(rendered, 0);
+
+    build_waveform_peaks(&state->waveform_peaks, state->waveform_buffer.samples, state->waveform_samples_count);
+    state->did_steal_voices = data.allocator.stolen_count > 0;
+    state->is_waveform_outdated = false;
+    state->has_dirty_ticks = false;
+    free_sound_events(&data);
 }
 
-static bool create_samples_from_notes(float *buffer, SoundState *data, uint32_t frames_per_buffer, int frames_per_tick) {
-    state->error_message = NULL;
-
-    float attack_frames_length = SAMPLE_RATE / 25;
-    float attack_decrement = 1.0f / attack_frames_length;
-
-    float release_frames_length = SAMPLE_RATE / 100;
-    float release_increment = 1.0f / release_frames_length;
-
-    for (uint32_t buf_frame = 0; buf_frame < frames_per_buffer; buf_frame++) {
-        
-        // Start or stop notes
-        if (data->current_frame % frames_per_tick == 0) {
-            uint32_t current_tick = data->current_frame / frames_per_tick;
-
-            for (int note_index = 0; note_index < data->notes_count; note_index++) {
-                Note note = data->notes[note_index];
-                if (note.is_deleted)  continue;
-
-                // TODO: test various polyphony settings
-                if (current_tick == note.start_tick) {
-                    for (int i = 0; i < MAX_POLYPHONY; i++) {
-                        if (!data->active_notes[i].active) { // search for a first not yet active note
-                            data->active_notes[i].active = true;
-                            data->active_notes[i].is_releasing = false;
-                            data->active_notes[i].frequency = midiNoteToFrequency(note.key);
-                            data->active_notes[i].attack = 0.0f;
-                            data->active_notes[i].identifier = note_identifier(note);
-                            break;
-                        } else if (i == MAX_POLYPHONY - 1) {
-                            state->error_message = "MAX_POLYPHONY exceeded. Starting a midi event is impossible.";
-                            printf("%s\n", state->error_message);
-                            return false;
-                        }
-                    }
-                } else if (current_tick == note.end_tick) {
-                    int note_id = note_identifier(note);
-
-                    for (int i = 0; i < MAX_POLYPHONY; i++) {
-                        if (data->active_notes[i].identifier == note_id) { // search for the note by its identifier
-                            assert(data->active_notes[i].active);
-                            data->active_notes[i].is_releasing = true;
-                            break;
-                        } else if (i == MAX_POLYPHONY - 1) {
-                            state->error_message = "MAX_POLYPHONY exceeded. Stopping a midi event is impossible.";
-                            printf("%s\n", state->error_message);
-                            return false;
-                        }
-                    }
-                }
-            }
-        }
+void mark_dirty_ticks(uint32_t start_tick, uint32_t end_tick) {
+    if (!state->has_dirty_ticks) {
+        state->dirty_start_tick = start_tick;
+        state->dirty_end_tick = end_tick;
+        state->has_dirty_ticks = true;
+        return;
+    }
 
-        // Calculate attack/release and phase values
-        for (int i = 0; i < MAX_POLYPHONY; i++) {
-            if (!data->active_notes[i].active)  continue;
+    state->dirty_start_tick = fmin(state->dirty_start_tick, start_tick);
+    state->dirty_end_tick = fmax(state->dirty_end_tick, end_tick);
+}
 
-            float phase_increment = 2 * PI * data->active_notes[i].frequency / SAMPLE_RATE;
-            data->active_notes[i].phase_accumulator += phase_increment;
+// renders only the ticks changed since the last render, or everything when that's not possible
+void update_waveform_samples() {
+    if (state->is_waveform_outdated || state->waveform_samples_count == 0) {
+        create_waveform_samples();
+        return;
+    }
+    if (!state->has_dirty_ticks)  return;
+
+    PROFILE_SCOPE(PROFILE_UPDATE_WAVEFORM);
+    SoundState data = create_render_sound_state();
+    invalidate_voice_checkpoints(&state->voice_checkpoints, state->dirty_start_tick);
+
+    // a note keeps sounding for its release after end_tick, at most the release from full gain
+    uint32_t start_frame = state->dirty_start_tick * FRAMES_PER_TICK;
+    uint32_t end_frame = fmin(state->waveform_samples_count, state->dirty_end_tick * FRAMES_PER_TICK + release_length(UINT32_MAX));
+    if (state->did_steal_voices)  end_frame = state->waveform_samples_count;
+
+    // the range is rendered at its place in waveform_render_buffer, only its pages get committed,
+    // then it's copied over under stream_lock like create_waveform_samples swaps
+    SampleBuffer *rendered = &state->waveform_render_buffer;
+    resize_sample_buffer(rendered, (size_t) state->waveform_samples_count * NUMBER_OF_CHANNELS);
+    bool success = render_samples_range(rendered->samples, start_frame, end_frame, &data, render_threads_count());
+
+    ma_mutex_lock(&state->stream_lock);
+    if (success && start_frame < end_frame) {
+        size_t offset = (size_t) start_frame * NUMBER_OF_CHANNELS;
+        memcpy(state->waveform_buffer.samples + offset, rendered->samples + offset, sizeof(float) * (end_frame - start_frame) * NUMBER_OF_CHANNELS);
+    }
+    if (!success)  state->waveform_samples_count = 0;
+    state->waveform_samples_version += 1;
+    state->error_message = data.error_message;
+    ma_mutex_unlock(&state->stream_lock);
+    resize_sample_buffer(rendered, 0);
+
+    if (success)  update_waveform_peaks(&state->waveform_peaks, state->waveform_buffer.samples, start_frame, end_frame);
+    state->has_dirty_ticks = false;
+    free_sound_events(&data);
+}
 
-            // keep the phase in 2PI range
-            while (data->active_notes[i].phase_accumulator > 2 * PI) {
-                data->active_notes[i].phase_accumulator -= 2 * PI;
-            }
+// STREAMING
 
-            // note is fully playing when is_releasing==false and attack==1.0f
-            // otherwise attack will slowly increase or decrease depending on is_releasing
-            if (data->active_notes[i].is_releasing) {
-                data->active_notes[i].attack -= release_increment;
+static int compare_ints(const void *a, const void *b) {
+    int value1 = *(const int *)a;
+    int value2 = *(const int *)b;
+    if (value1 != value2)  return value1 < value2 ? -1 : 1;
+    return 0;
+}
 
-                if (data->active_notes[i].attack <= 0.0f) {
-                    data->active_notes[i].active = false;
-                }
-            } else {
-                data->active_notes[i].attack += attack_decrement;
-                if (data->active_notes[i].attack > 1.0f) {
-                    data->active_notes[i].attack = 1.0f;
-                }
-            }
+// rebuilds streaming events from the current notes
+// the render thread only plays the events, so the notes are scanned, compacted and sorted into new events without
+// stream_lock, it's only held to swap the events in and release the voices of deleted notes
+static void rebuild_stream_sound_state(bool should_restart_playback) {
+    // voices of deleted notes would never get their note off event, they are released under the lock
+    // (collected before compaction, it takes the deleted notes away), sorted to look up the held voices
+    int *deleted_identifiers = NULL;
+    int deleted_count = 0;
+    if (!should_restart_playback && state->notes.deleted_count > 0) {
+        deleted_identifiers = malloc(sizeof(int) * state->notes.deleted_count);
+        assert(deleted_identifiers != NULL && "Buy more RAM lol");
+        for (int i = 0; i < state->notes.notes_count; i++) {
+            Note *note = note_at(&state->notes, i);
+            if (note->is_deleted)  deleted_identifiers[deleted_count++] = note_identifier(*note);
         }
+        qsort(deleted_identifiers, deleted_count, sizeof(int), compare_ints);
+    }
 
-        // Mix active notes
-        float mixedSample = 0.0f;
-        for (int i = 0; i < MAX_POLYPHONY; i++) {
-            if (!data->active_notes[i].active)  continue;
-
-            float wave_value = sinf(data->active_notes[i].phase_accumulator);
-            wave_value *= data->active_notes[i].attack;
-            mixedSample += wave_value / MAX_POLYPHONY;
+    // positions change, so the index and the events are made after it
+    if (should_compact_note_store(&state->notes)) {
+        compact_note_store(&state->notes);
+        build_note_index(&state->note_index, &state->notes);
+    }
+    SoundState events = { .notes = &state->notes };
+    create_sound_events(&events);
+
+    ma_mutex_lock(&state->stream_lock);
+    SoundState *data = &state->stream_sound_state;
+    SoundEvent *previous_events = data->events;
+    data->notes = &state->notes;
+    data->waveform = state->oscillator_waveform;
+    data->events = events.events;
+    data->events_count = events.events_count;
+
+    for (int v = 0; deleted_count > 0 && v < data->allocator.voices_count; v++) {
+        int note_id = data->allocator.voices[v].identifier;
+        if (data->allocator.voices[v].is_released)  continue;
+        if (bsearch(&note_id, deleted_identifiers, deleted_count, sizeof(int), compare_ints) == NULL)  continue;
+
+        int i;
+        while ((i = release_allocated_voice(&data->allocator, note_id, data->current_frame)) >= 0) {
+            release_voice(&data->voices, i);
         }
+    }
 
-        *buffer++ = mixedSample; // left
-        *buffer++ = mixedSample; // right
-        data->current_frame++;
+    if (should_restart_playback) {
+        data->current_frame = 0;
+        init_voice_allocator(&data->allocator, state->steal_policy, state->is_voice_pool_growable);
+        memset(&data->voices, 0, sizeof(data->voices));
+
+        // plug_audio_callback drops the blocks already made and starts counting from 0
+        discard_ring(&state->playback_ring);
+        state->render_sample_position = 0;
+        state->is_render_finished = false;
+        state->error_message = NULL;
     }
+    seek_sound_events(data);
+    ma_mutex_unlock(&state->stream_lock);
 
-    return true;
+    free(previous_events);
+    free(deleted_identifiers);
 }
 
-void create_waveform_samples() {
-    SoundState data = {
-        .notes = state->notes,
-        .notes_count = state->notes_count,
-        .current_frame = 0,
-        .active_notes = { }
-    };
+static void restart_playback(void) {
+    rebuild_stream_sound_state(true);
+}
+
+void update_sound_after_notes_change(bool should_restart_playback) {
+    rebuild_stream_sound_state(should_restart_playback);
 
-    uint32_t end_tick = state->notes[state->notes_count-1].end_tick; // NOTE: only considering notes are sorted
-    int current_frame = 0;
+    // waveform is only needed right away when it's visible or not streaming
+    if (state->is_streaming_mode && !state->is_displaying_waveform)  return;
+    update_waveform_samples();
+}
 
-    /* float silence_tail = 0; */
+static bool is_stream_playing_notes(SoundState *data) {
+    if (data->event_cursor < data->events_count)  return true;
 
-    while (true) {
-        bool success = create_samples_from_notes(
-            &state->waveform_samples[FRAMES_PER_BUFFER * current_frame * NUMBER_OF_CHANNELS],
-            &data,
-            FRAMES_PER_BUFFER,
-            FRAMES_PER_TICK
-        );
+    for (int i = 0; i < data->voices.voices_count; i++) {
+        if (!is_voice_free(&data->voices, i))  return true;
+    }
+    return false;
+}
 
-        if (!success) {
-            state->waveform_samples_count = 0;
-            return;
+// PLAYBACK
+
+// writes the next block of the song into playback_ring, false when there's nothing to do
+// caller has to hold stream_lock
+static bool render_playback_block(void) {
+    if (!state->is_playing_sound || state->is_render_finished)  return false;
+    if (ring_space(&state->playback_ring) < FRAMES_PER_BUFFER)  return false;
+
+    if (state->is_streaming_mode) {
+        SoundState *data = &state->stream_sound_state;
+        float block[FRAMES_PER_BUFFER * NUMBER_OF_CHANNELS];
+
+        if (!is_stream_playing_notes(data)) {
+            state->is_render_finished = true;
+            return false;
+        }
+        if (!create_samples_from_notes(block, data, FRAMES_PER_BUFFER, FRAMES_PER_TICK)) {
+            state->error_message = data->error_message;
+            state->is_render_finished = true;
+            return false;
         }
 
-        /* if (state->waveform_samples[FRAMES_PER_BUFFER * current_frame * NUMBER_OF_CHANNELS] == 0) { */
-        /*     silence_tail += 1; */
-        /* } */
+        write_ring(&state->playback_ring, block, FRAMES_PER_BUFFER);
+        return true;
+    }
 
-        uint32_t current_tick = data.current_frame / NUMBER_OF_CHANNELS / FRAMES_PER_TICK;
-        if (current_tick > end_tick)  break;
-        current_frame += 1;
+    // NOTE: waveform_samples_count is played as a count of samples
+    int samples_count = fmin(FRAMES_PER_BUFFER * NUMBER_OF_CHANNELS, state->waveform_samples_count - state->render_sample_position);
+    if (samples_count <= 0) {
+        state->is_render_finished = true;
+        return false;
     }
 
-    state->waveform_samples_count = current_frame * FRAMES_PER_BUFFER;
+    write_ring(&state->playback_ring, &state->waveform_buffer.samples[state->render_sample_position], samples_count / NUMBER_OF_CHANNELS);
+    state->render_sample_position += samples_count;
+    return true;
 }
 
-void audio_callback(ma_device *device, void *output, const void *input, ma_uint32 frame_count) {
-    (void)device;
-    (void)input;
+static void *render_thread_main(void *argument) {
+    (void)argument;
 
-    if (!state->is_playing_sound || state->waveform_samples_count == 0) {
-        memset(output, 0, sizeof(float) * frame_count * NUMBER_OF_CHANNELS);
-        return;
+    while (!state->should_stop_render_thread) {
+        uint64_t start_time = profile_time();
+        ma_mutex_lock(&state->stream_lock);
+        bool did_render = render_playback_block();
+        ma_mutex_unlock(&state->stream_lock);
+
+        // waiting for the lock counts, a block has to be ready before the device plays the previous one
+        if (did_render) {
+            record_profile_sample(PROFILE_RENDER_BLOCK, start_time, profile_time() - start_time, (uint64_t) FRAMES_PER_BUFFER * 1000000000 / SAMPLE_RATE);
+        }
+
+        // the ring is full or nothing is playing, it has room for 10+ of these naps
+        if (!did_render) {
+            struct timespec nap = { 0, 1000000 };
+            nanosleep(&nap, NULL);
+        }
     }
+    return NULL;
+}
 
-    int available_samples = state->waveform_samples_count - state->playback_sample_counter;
-    int samples_to_copy_count = available_samples;
-    int desired_samples_count = frame_count * NUMBER_OF_CHANNELS;
-
-    if (samples_to_copy_count < desired_samples_count) { // not enough samples: copy them and fill the rest with zeroes
-        // TODO: audio is chopped at the end, maybe we can solve this?
-        /* int leftover_samples_count = desired_samples_count - samples_to_copy_count; */
-        /* float *samples_end_position = &((float*)output)[samples_to_copy_count]; */
-        /* memset((void*)samples_end_position, 0, sizeof(float) * leftover_samples_count); */
-    } else { // enough samples: ok
-        samples_to_copy_count = desired_samples_count;
+static void start_export(ExportKind kind, const char *path) {
+    start_export_job(&state->export_job, &state->notes, (ExportSettings) {
+        .kind = kind,
+        .path = path,
+        .waveform = state->oscillator_waveform,
+        .steal_policy = state->steal_policy,
+        .is_voice_pool_growable = state->is_voice_pool_growable,
+        .wav_format = WAV_FLOAT32,
+        .threads_count = render_threads_count()
+    });
+}
+
+static void start_render_thread(void) {
+    state->should_stop_render_thread = false;
+    state->has_render_thread = pthread_create(&state->render_thread, NULL, render_thread_main, NULL) == 0;
+    if (!state->has_render_thread) {
+        state->error_message = RENDER_THREAD_ERROR;
+        printf("%s\n", state->error_message);
     }
+}
 
-    void *sample_position = &state->waveform_samples[state->playback_sample_counter];
-    memcpy(output, sample_position, sizeof(float) * samples_to_copy_count);
-    state->playback_sample_counter += samples_to_copy_count;
+// has to be called before the plugin is unloaded, the thread runs its code
+static void stop_render_thread(void) {
+    if (!state->has_render_thread)  return;
+    state->should_stop_render_thread = true;
+    pthread_join(state->render_thread, NULL);
+    state->has_render_thread = false;
 }
 
-void init_audio_device() {
-    ma_device_config config = ma_device_config_init(ma_device_type_playback);
-    config.playback.format = ma_format_f32;
-    config.playback.channels = NUMBER_OF_CHANNELS;
-    config.sampleRate = SAMPLE_RATE;
-    config.dataCallback = audio_callback;
+// called by the audio device of the host, never blocks: plays whatever the render thread has made so far,
+// silence for the rest
+void plug_audio_callback(float *frames, uint32_t frame_count) {
+    uint64_t start_time = profile_time();
+    if (apply_ring_discard(&state->playback_ring)) {
+        state->playback_sample_counter = 0;
+    }
 
-    if (ma_device_init(NULL, &config, &state->audio_device) != MA_SUCCESS) {
-        printf("Error initializing audio device.\n");
-        return;
+    uint32_t frames_read = 0;
+    if (state->is_playing_sound) {
+        frames_read = read_ring(&state->playback_ring, frames, frame_count);
     }
 
-    ma_device_start(&state->audio_device);
-    printf("Audio device initialized and started.\n");
+    // the render thread fell behind, silence is played in the middle of the song
+    bool is_starved = state->is_playing_sound && frames_read < frame_count && !state->is_render_finished;
+    if (is_starved && audio_meter != NULL)  count_starved_callback(audio_meter);
+
+    memset(&frames[frames_read * NUMBER_OF_CHANNELS], 0, sizeof(float) * (frame_count - frames_read) * NUMBER_OF_CHANNELS);
+    state->playback_sample_counter += frames_read * NUMBER_OF_CHANNELS;
+
+    // the device needs the next buffer after frame_count frames
+    record_profile_sample(PROFILE_AUDIO_CALLBACK, start_time, profile_time() - start_time, (uint64_t) frame_count * 1000000000 / SAMPLE_RATE);
 }
 
 // plugin life cycle
@@ -628,10 +808,16 @@ void plug_init() {
     assert(state != NULL && "Buy more RAM lol");
     memset(state, 0, sizeof(*state));
 
-    init_audio_device();
+    state->is_streaming_mode = true;
+    state->steal_policy = STEAL_RELEASING_FIRST;
+    ma_mutex_init(&state->stream_lock);
+    init_ring(&state->playback_ring, PLAYBACK_RING_FRAMES);
+    init_voices();
     
     create_notes();
-    create_waveform_samples();
+    state->is_waveform_outdated = true;
+    update_sound_after_notes_change(true);
+    start_render_thread();
     
     state->waveform_scroll_zoom_state = (ScrollZoom) {
         .zoom_x = 0.5f,
@@ -649,44 +835,81 @@ void plug_init() {
 }
 
 void plug_cleanup() {
-    ma_device_uninit(&state->audio_device);
+    stop_export_job(&state->export_job);
+    stop_render_thread();
+    ma_mutex_uninit(&state->stream_lock);
+    free_ring(&state->playback_ring);
+    free_sample_buffer(&state->waveform_buffer);
+    free_sample_buffer(&state->waveform_render_buffer);
+    free_sound_events(&state->stream_sound_state);
+    free_waveform_peaks(&state->waveform_peaks);
+    free_voice_checkpoints(&state->voice_checkpoints);
+    free(state->waveform_polyline.points);
+    free(state->note_rects.rects);
+    free(state->note_rects.colors);
+    free_note_index(&state->note_index);
+    free_note_store(&state->notes);
     free(state);
     state = NULL;
 }
 
+// the host keeps calling plug_audio_callback of this library until the new one is loaded,
+// it plays what's left in playback_ring meanwhile
+// a running export is cancelled, its thread runs this library's code too
 void *plug_pre_reload() {
-    // TODO: on macOS it crashes if we don't stop audio before hotreload, but on Linux it's ok
-    ma_device_uninit(&state->audio_device);
+    stop_export_job(&state->export_job);
+    stop_render_thread();
     return state;
 }
 
 void plug_post_reload(void *old_state) {
     state = old_state;
-    init_audio_device();
+    init_voices();
+    start_render_thread();
+}
+
+// called by the host right after the library is loaded
+void plug_set_host(HostContext *context) {
+    audio_meter = context->audio_meter;
+    set_profile_tracer(context->tracer);
 }
 
 void plug_update() {
     assert(state != NULL && "Plugin state is not initialized.");
+    PROFILE_SCOPE(PROFILE_FRAME);
     int screen_width = GetScreenWidth();
     int screen_height = GetScreenHeight();
 
-    if (state->waveform_samples_count == state->playback_sample_counter) {
+    if (state->is_render_finished && ring_available(&state->playback_ring) == 0) {
         state->is_playing_sound = false;
-        state->playback_sample_counter = 0;
+        restart_playback();
     }
+    load_dropped_midi_file();
+    finish_export_job(&state->export_job);
 
     BeginDrawing();
         ClearBackground(DARKGRAY);
         ClearConsole();
 
         Console("FPS: %d", GetFPS());
-        Console("Notes count: %d", state->notes_count);
+        Console("Playback: %s", state->is_streaming_mode ? "streaming" : "pre-rendered");
+        Console("Mix kernel: %s", mix_voices_kernel_name());
+        Console("Notes count: %d", state->notes.notes_count - state->notes.deleted_count);
         Console("Samples count: %d", state->waveform_samples_count);
 
         char time[10];
         get_time_string(time, state->waveform_samples_count / NUMBER_OF_CHANNELS / (SAMPLE_RATE / 1000));
         Console("Audio length: %s", time);
 
+        if (state->export_job.message[0] != 0)  Console("%.80s", state->export_job.message); // Console lines are short
+
+        if (audio_meter != NULL) {
+            Console("DSP load: %.0f%%, max %.0f%%, period %u frames",
+                    audio_meter->load * 100, audio_meter->max_load * 100, audio_meter->period_frames);
+            Console("Xruns: %u late (%u periods), %u slow, %u starved",
+                    audio_meter->late_count, audio_meter->missed_periods_count, audio_meter->overrun_count, audio_meter->starved_count);
+        }
+
         const int notes_panel_top_offset = 200;
         if (!state->is_displaying_waveform) {
             DrawNotes(
@@ -707,15 +930,23 @@ void plug_update() {
 
         if (DrawButton("Generate", 1, screen_width - 170, 20, 160, 40)) {
             create_notes();
-            create_waveform_samples();
+            state->is_waveform_outdated = true;
+            update_sound_after_notes_change(true);
         }
 
-        if (DrawButton("Export MIDI", 2, screen_width - 340, 20, 160, 40)) {
-            save_notes_midi_file(state->notes, state->notes_count);
-        }
+        if (state->export_job.is_running) {
+            DrawProgressBar("Exporting", export_job_progress(&state->export_job), (Rectangle) { screen_width - 340, 20, 160, 40 });
+            if (DrawButton("Cancel", 3, screen_width - 340, 70, 160, 40)) {
+                cancel_export_job(&state->export_job);
+            }
+        } else {
+            if (DrawButton("Export MIDI", 2, screen_width - 340, 20, 160, 40)) {
+                start_export(EXPORT_MIDI, "1.mid");
+            }
 
-        if (DrawButton("Export WAV", 3, screen_width - 340, 70, 160, 40)) {
-            save_notes_wave_file(state->waveform_samples, state->waveform_samples_count, "export.wav");
+            if (DrawButton("Export WAV", 3, screen_width - 340, 70, 160, 40)) {
+                start_export(EXPORT_WAV, "export.wav");
+            }
         }
 
         if (state->is_playing_sound) {
@@ -728,17 +959,61 @@ void plug_update() {
             }
         }
         if (DrawButton("Reset", 4, screen_width - 510, 70, 160, 40)) {
-            state->playback_sample_counter = 0;
             state->is_playing_sound = false;
+            restart_playback();
+            if (audio_meter != NULL)  reset_audio_meter(audio_meter);
+        }
+
+        char *mode_title = state->is_streaming_mode ? "Pre-render" : "Streaming";
+        if (DrawButton(mode_title, 5, screen_width - 680, 20, 160, 40)) {
+            state->is_playing_sound = false;
+            state->is_streaming_mode = !state->is_streaming_mode;
+            restart_playback();
+            if (!state->is_streaming_mode)  update_waveform_samples();
+        }
+
+        char waveform_title[20];
+        sprintf(waveform_title, "Wave: %s", waveform_name(state->oscillator_waveform));
+        if (DrawButton(waveform_title, 6, screen_width - 680, 70, 160, 40)) {
+            state->oscillator_waveform = (state->oscillator_waveform + 1) % WAVEFORMS_COUNT;
+            state->is_waveform_outdated = true;
+            update_sound_after_notes_change(false);
         }
 
-        if (state->error_message != NULL) {
+        char steal_title[20];
+        sprintf(steal_title, "Steal: %s", steal_policy_name(state->steal_policy));
+        if (DrawButton(steal_title, 7, screen_width - 850, 20, 160, 40)) {
+            state->steal_policy = (state->steal_policy + 1) % STEAL_POLICIES_COUNT;
+            state->is_waveform_outdated = true;
+            update_sound_after_notes_change(true);
+        }
+
+        char pool_title[20];
+        if (state->is_voice_pool_growable)  sprintf(pool_title, "Voices: grow");
+        else  sprintf(pool_title, "Voices: %d", MAX_POLYPHONY);
+        if (DrawButton(pool_title, 8, screen_width - 850, 70, 160, 40)) {
+            state->is_voice_pool_growable = !state->is_voice_pool_growable;
+            state->is_waveform_outdated = true;
+            update_sound_after_notes_change(true);
+        }
+
+        if (DrawButton("Timings", 9, screen_width - 1020, 20, 160, 40)) {
+            state->is_showing_profile = !state->is_showing_profile;
+        }
+
+        // renders replace error_message, playback stays silent as long as there's no render thread though
+        if (!state->has_render_thread) {
+            DrawConsoleLine(RENDER_THREAD_ERROR);
+        } else if (state->error_message != NULL) {
             DrawConsoleLine(state->error_message);
         }
 
+        if (state->is_showing_profile) {
+            DrawProfileOverlay(20, notes_panel_top_offset, screen_width - 40);
+        }
+
     EndDrawing();
 }
 
 // TODO: add undo for breaking actions: notes delete, generation
 // TODO: export .wav in wav.h
-// TODO: get audio callback from new state after hot reloading
@@ -0,0 +1,115 @@
+#include <stdbool.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "profile.h"
+
+// every library copy has its own rings, a hot reload starts the history over
+static ProfileRing rings[PROFILE_SECTIONS_COUNT];
+static Tracer *tracer = NULL;
+
+static int trace_threads[PROFILE_SECTIONS_COUNT] = {
+    [PROFILE_FRAME]           = -1, // traced by the host
+    [PROFILE_DRAW_NOTES]      = TRACE_THREAD_UI,
+    [PROFILE_DRAW_WAVEFORM]   = TRACE_THREAD_UI,
+    [PROFILE_CREATE_WAVEFORM] = TRACE_THREAD_UI,
+    [PROFILE_UPDATE_WAVEFORM] = TRACE_THREAD_UI,
+    [PROFILE_RENDER_BLOCK]    = TRACE_THREAD_RENDER,
+    [PROFILE_AUDIO_CALLBACK]  = -1, // traced by the host
+};
+
+void set_profile_tracer(Tracer *new_tracer) {
+    tracer = new_tracer;
+}
+
+uint64_t profile_time(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+ProfileTimer begin_profile_timer(ProfileSection section) {
+    return (ProfileTimer) { section, profile_time() };
+}
+
+void end_profile_timer(ProfileTimer *timer) {
+    record_profile_sample(timer->section, timer->start, profile_time() - timer->start, 0);
+}
+
+void record_profile_sample(ProfileSection section, uint64_t start, uint64_t duration, uint64_t budget) {
+    if (trace_threads[section] >= 0) {
+        trace_span(tracer, trace_threads[section], profile_section_name(section), start, duration);
+    }
+
+    ProfileRing *ring = &rings[section];
+    uint32_t count = atomic_load_explicit(&ring->count, memory_order_relaxed);
+    uint32_t index = count & (PROFILE_HISTORY - 1);
+
+    ring->durations[index] = fmin(duration, UINT32_MAX);
+    ring->budgets[index] = fmin(budget, UINT32_MAX);
+    atomic_store_explicit(&ring->count, count + 1, memory_order_release);
+}
+
+static int copy_samples(ProfileSection section, float *durations, float *budgets, int count) {
+    ProfileRing *ring = &rings[section];
+    uint32_t recorded_count = atomic_load_explicit(&ring->count, memory_order_acquire);
+    if ((uint32_t) count > recorded_count)  count = recorded_count;
+    if (count > PROFILE_HISTORY)  count = PROFILE_HISTORY;
+
+    for (int i = 0; i < count; i++) {
+        uint32_t index = (recorded_count - count + i) & (PROFILE_HISTORY - 1);
+        durations[i] = ring->durations[index] / 1e6f;
+        if (budgets != NULL)  budgets[i] = ring->budgets[index] / 1e6f;
+    }
+    return count;
+}
+
+int copy_profile_durations(ProfileSection section, float *durations, int count) {
+    return copy_samples(section, durations, NULL, count);
+}
+
+static int compare_floats(const void *a, const void *b) {
+    float value1 = *(const float *)a;
+    float value2 = *(const float *)b;
+    if (value1 != value2)  return value1 < value2 ? -1 : 1;
+    return 0;
+}
+
+ProfileSummary summarize_profile_section(ProfileSection section) {
+    float durations[PROFILE_HISTORY];
+    float budgets[PROFILE_HISTORY];
+    int count = copy_samples(section, durations, budgets, PROFILE_HISTORY);
+
+    ProfileSummary summary = { .samples_count = count };
+    if (count == 0)  return summary;
+
+    summary.last = durations[count - 1];
+    summary.budget = budgets[count - 1];
+    for (int i = 0; i < count; i++) {
+        if (budgets[i] > 0)  summary.worst_load = fmax(summary.worst_load, durations[i] / budgets[i]);
+    }
+
+    qsort(durations, count, sizeof(float), compare_floats);
+    summary.median = durations[count / 2];
+    summary.p99 = durations[(int) ceil(count * 0.99) - 1];
+    summary.max = durations[count - 1];
+    return summary;
+}
+
+const char *profile_section_name(ProfileSection section) {
+    switch (section) {
+        case PROFILE_FRAME:            return "frame";
+        case PROFILE_DRAW_NOTES:       return "draw notes";
+        case PROFILE_DRAW_WAVEFORM:    return "draw waveform";
+        case PROFILE_CREATE_WAVEFORM:  return "render song";
+        case PROFILE_UPDATE_WAVEFORM:  return "render edits";
+        case PROFILE_RENDER_BLOCK:     return "render block";
+        case PROFILE_AUDIO_CALLBACK:   return "audio callback";
+        default:                       return "unknown";
+    }
+}
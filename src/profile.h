@@ -0,0 +1,69 @@
+#ifndef PROFILE_INCLUDES
+#define PROFILE_INCLUDES
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "trace.h"
+
+#define PROFILE_HISTORY 256 // samples kept per section, power of two
+
+typedef enum {
+    PROFILE_FRAME,           // ui thread: plug_update, including EndDrawing
+    PROFILE_DRAW_NOTES,      // ui thread
+    PROFILE_DRAW_WAVEFORM,   // ui thread
+    PROFILE_CREATE_WAVEFORM, // ui thread: create_waveform_samples, the whole song
+    PROFILE_UPDATE_WAVEFORM, // ui thread: update_waveform_samples, only the dirty ticks
+    PROFILE_RENDER_BLOCK,    // render thread: one block into playback_ring
+    PROFILE_AUDIO_CALLBACK,  // audio thread: plug_audio_callback, its budget is the device deadline
+    PROFILE_SECTIONS_COUNT
+} ProfileSection;
+
+// every section is only recorded by the thread named above, so its ring belongs to that thread:
+// recording never waits, readers copy the latest samples and can see the oldest one being overwritten
+typedef struct {
+    uint32_t durations[PROFILE_HISTORY]; // nanoseconds
+    uint32_t budgets[PROFILE_HISTORY];   // nanoseconds the section had, 0 when it has no deadline
+    _Atomic uint32_t count;              // samples recorded so far, wraps around by overflowing
+} ProfileRing;
+
+typedef struct {
+    ProfileSection section;
+    uint64_t start;
+} ProfileTimer;
+
+// milliseconds over the history of a section
+typedef struct {
+    int samples_count;
+    float last;
+    float median;
+    float p99;
+    float max;
+    float budget;     // of the latest sample, 0 when the section has no deadline
+    float worst_load; // highest duration / budget
+} ProfileSummary;
+
+// monotonic nanoseconds (clock_gettime, a vdso call and no syscall on linux and macos), same clock as trace_time
+uint64_t profile_time(void);
+
+ProfileTimer begin_profile_timer(ProfileSection section);
+void end_profile_timer(ProfileTimer *timer);
+void record_profile_sample(ProfileSection section, uint64_t start, uint64_t duration, uint64_t budget);
+
+// samples are also recorded as trace spans while the host records a trace,
+// except the frame and the audio callback which the host traces itself
+void set_profile_tracer(Tracer *tracer);
+
+// times the rest of the enclosing block, early returns included
+#define PROFILE_JOIN(a, b) a##b
+#define PROFILE_NAME(line) PROFILE_JOIN(profile_timer_, line)
+#define PROFILE_SCOPE(section) \
+    ProfileTimer PROFILE_NAME(__LINE__) __attribute__((cleanup(end_profile_timer))) = begin_profile_timer(section)
+
+// copies up to count latest durations in milliseconds, oldest first, returns how many were copied
+int copy_profile_durations(ProfileSection section, float *durations, int count);
+ProfileSummary summarize_profile_section(ProfileSection section);
+const char *profile_section_name(ProfileSection section);
+
+#endif // PROFILE_INCLUDES
@@ -0,0 +1,91 @@
+#include <stdbool.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ring.h"
+
+void init_ring(RingBuffer *ring, uint32_t capacity) {
+    assert(capacity > 0 && (capacity & (capacity - 1)) == 0 && "Ring capacity has to be a power of two.");
+
+    ring->samples = malloc(sizeof(float) * capacity * NUMBER_OF_CHANNELS);
+    assert(ring->samples != NULL && "Buy more RAM lol");
+    ring->capacity = capacity;
+    atomic_init(&ring->write_index, 0);
+    atomic_init(&ring->read_index, 0);
+    atomic_init(&ring->discard_index, 0);
+}
+
+void free_ring(RingBuffer *ring) {
+    free(ring->samples);
+    ring->samples = NULL;
+    ring->capacity = 0;
+}
+
+// copies frames_count frames between the ring at index and frames, in up to two parts
+static void copy_ring_frames(RingBuffer *ring, uint32_t index, float *frames, uint32_t frames_count, bool is_writing) {
+    uint32_t start = index & (ring->capacity - 1);
+    uint32_t first_count = frames_count < ring->capacity - start ? frames_count : ring->capacity - start;
+    size_t frame_size = sizeof(float) * NUMBER_OF_CHANNELS;
+
+    float *ring_part = &ring->samples[start * NUMBER_OF_CHANNELS];
+    float *wrapped_frames = &frames[first_count * NUMBER_OF_CHANNELS];
+    if (is_writing) {
+        memcpy(ring_part, frames, first_count * frame_size);
+        memcpy(ring->samples, wrapped_frames, (frames_count - first_count) * frame_size);
+    } else {
+        memcpy(frames, ring_part, first_count * frame_size);
+        memcpy(wrapped_frames, ring->samples, (frames_count - first_count) * frame_size);
+    }
+}
+
+uint32_t ring_space(RingBuffer *ring) {
+    uint32_t write_index = atomic_load_explicit(&ring->write_index, memory_order_relaxed);
+    uint32_t read_index = atomic_load_explicit(&ring->read_index, memory_order_acquire);
+    return ring->capacity - (write_index - read_index);
+}
+
+uint32_t write_ring(RingBuffer *ring, const float *frames, uint32_t frames_count) {
+    uint32_t space = ring_space(ring);
+    if (frames_count > space)  frames_count = space;
+
+    uint32_t write_index = atomic_load_explicit(&ring->write_index, memory_order_relaxed);
+    copy_ring_frames(ring, write_index, (float *) frames, frames_count, true);
+
+    // frames have to be in place before the consumer can see them
+    atomic_store_explicit(&ring->write_index, write_index + frames_count, memory_order_release);
+    return frames_count;
+}
+
+void discard_ring(RingBuffer *ring) {
+    uint32_t write_index = atomic_load_explicit(&ring->write_index, memory_order_relaxed);
+    atomic_store_explicit(&ring->discard_index, write_index, memory_order_release);
+}
+
+bool apply_ring_discard(RingBuffer *ring) {
+    uint32_t read_index = atomic_load_explicit(&ring->read_index, memory_order_relaxed);
+    uint32_t discard_index = atomic_load_explicit(&ring->discard_index, memory_order_acquire);
+    if ((int32_t) (discard_index - read_index) <= 0)  return false;
+
+    atomic_store_explicit(&ring->read_index, discard_index, memory_order_release);
+    return true;
+}
+
+uint32_t ring_available(RingBuffer *ring) {
+    uint32_t read_index = atomic_load_explicit(&ring->read_index, memory_order_relaxed);
+    uint32_t write_index = atomic_load_explicit(&ring->write_index, memory_order_acquire);
+    return write_index - read_index;
+}
+
+uint32_t read_ring(RingBuffer *ring, float *frames, uint32_t frames_count) {
+    uint32_t available = ring_available(ring);
+    if (frames_count > available)  frames_count = available;
+
+    uint32_t read_index = atomic_load_explicit(&ring->read_index, memory_order_relaxed);
+    copy_ring_frames(ring, read_index, frames, frames_count, false);
+
+    // the producer can reuse the frames only after they are copied out
+    atomic_store_explicit(&ring->read_index, read_index + frames_count, memory_order_release);
+    return frames_count;
+}
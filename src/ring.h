@@ -0,0 +1,34 @@
+#ifndef RING_INCLUDES
+#define RING_INCLUDES
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "shared.h"
+
+// single producer, single consumer ring of interleaved frames, neither side ever blocks or locks
+// indices only grow and wrap around by overflowing, capacity is a power of two
+typedef struct {
+    float *samples;
+    uint32_t capacity; // in frames
+
+    _Atomic uint32_t write_index;   // written by the producer
+    _Atomic uint32_t read_index;    // written by the consumer
+    _Atomic uint32_t discard_index; // written by the producer, consumer skips everything before it
+} RingBuffer;
+
+void init_ring(RingBuffer *ring, uint32_t capacity);
+void free_ring(RingBuffer *ring);
+
+// producer side
+uint32_t ring_space(RingBuffer *ring);
+uint32_t write_ring(RingBuffer *ring, const float *frames, uint32_t frames_count);
+void discard_ring(RingBuffer *ring); // everything written so far won't be read
+
+// consumer side, true when a discard was applied since the last call
+bool apply_ring_discard(RingBuffer *ring);
+uint32_t ring_available(RingBuffer *ring);
+uint32_t read_ring(RingBuffer *ring, float *frames, uint32_t frames_count);
+
+#endif // RING_INCLUDES
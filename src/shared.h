@@ -16,6 +16,7 @@ typedef struct {
 #define FRAMES_PER_BUFFER   256
 #define NUMBER_OF_CHANNELS  2
 #define SAMPLE_RATE         (44100)
+#define FRAMES_PER_TICK     (SAMPLE_RATE / 100)
 
 #if 1
 #define add_breadcrumbs() printf("- %s: %s:%d\n", __func__, __FILE__, __LINE__);
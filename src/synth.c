@@ -0,0 +1,340 @@
+#include <stdbool.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "synth.h"
+
+#define MAX_RENDER_THREADS 64
+#define SEGMENTS_PER_THREAD 4 // more segments than threads evens out dense and sparse parts of the song
+
+int note_identifier(Note note) {
+    return 1000000000 + note.start_tick * 1000 + note.key;
+}
+
+static int compare_sound_events(const void *a, const void *b) {
+    const SoundEvent *event1 = (const SoundEvent *)a;
+    const SoundEvent *event2 = (const SoundEvent *)b;
+    if (event1->tick != event2->tick)  return event1->tick < event2->tick ? -1 : 1;
+
+    // same tick: keep the order of notes, note on goes before its own note off
+    if (event1->note_index != event2->note_index)  return event1->note_index < event2->note_index ? -1 : 1;
+    return (int)event2->is_on - (int)event1->is_on;
+}
+
+void create_sound_events(SoundState *data) {
+    int notes_count = data->notes->notes_count - data->notes->deleted_count;
+    data->events = malloc(sizeof(SoundEvent) * notes_count * 2 + 1);
+    assert(data->events != NULL && "Buy more RAM lol");
+    data->events_count = 0;
+    data->event_cursor = 0;
+
+    for (int i = 0; i < data->notes->notes_count; i++) {
+        Note note = *note_at(data->notes, i);
+        if (note.is_deleted)  continue;
+
+        int identifier = note_identifier(note);
+        data->events[data->events_count++] = (SoundEvent) { note.start_tick, i, identifier, note.key, true };
+        data->events[data->events_count++] = (SoundEvent) { note.end_tick, i, identifier, note.key, false };
+    }
+
+    qsort(data->events, data->events_count, sizeof(SoundEvent), compare_sound_events);
+}
+
+void seek_sound_events(SoundState *data) {
+    int low = 0;
+    int high = data->events_count;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if ((uint64_t) data->events[middle].tick * FRAMES_PER_TICK < data->current_frame)  low = middle + 1;
+        else  high = middle;
+    }
+    data->event_cursor = low;
+}
+
+void free_sound_events(SoundState *data) {
+    free(data->events);
+    data->events = NULL;
+    data->events_count = 0;
+    data->event_cursor = 0;
+}
+
+bool create_samples_from_notes(float *buffer, SoundState *data, uint32_t frames_per_buffer, int frames_per_tick) {
+    data->error_message = NULL;
+
+    uint32_t buf_frame = 0;
+    while (buf_frame < frames_per_buffer) {
+
+        // Start or stop notes
+        if (data->current_frame % frames_per_tick == 0) {
+            uint32_t current_tick = data->current_frame / frames_per_tick;
+
+            // events in the past could not fire (e.g. when notes start before current_frame)
+            while (data->event_cursor < data->events_count && data->events[data->event_cursor].tick < current_tick) {
+                data->event_cursor++;
+            }
+
+            for (; data->event_cursor < data->events_count; data->event_cursor++) {
+                SoundEvent event = data->events[data->event_cursor];
+                if (event.tick != current_tick)  break;
+
+                int note_id = event.identifier;
+                if (event.is_on) {
+                    int i = allocate_voice(&data->allocator, note_id, event.key, data->current_frame);
+                    if (i < 0) {
+                        data->error_message = "MAX_POLYPHONY exceeded. Starting a midi event is impossible.";
+                        printf("%s\n", data->error_message);
+                        return false;
+                    }
+                    start_voice(&data->voices, i, event.key, data->waveform, note_id);
+                } else {
+                    // a stolen note has no voice to release
+                    int i = release_allocated_voice(&data->allocator, note_id, data->current_frame);
+                    if (i >= 0)  release_voice(&data->voices, i);
+                }
+            }
+        }
+
+        // Mix active notes until the next tick or the end of the buffer
+        uint32_t frames_until_tick = frames_per_tick - data->current_frame % frames_per_tick;
+        uint32_t frames_count = fmin(frames_until_tick, frames_per_buffer - buf_frame);
+        mix_voices(&data->voices, buffer, frames_count);
+
+        buffer += frames_count * NUMBER_OF_CHANNELS;
+        buf_frame += frames_count;
+        data->current_frame += frames_count;
+    }
+
+    return true;
+}
+
+// NOTE: rendering stops at the first buffer whose end, counted in samples rather than frames,
+// passes end_tick. the last buffer is not counted.
+uint32_t song_frames_count(uint32_t end_tick) {
+    uint64_t end_samples = (uint64_t) (end_tick + 1) * FRAMES_PER_TICK * NUMBER_OF_CHANNELS;
+    uint64_t buffers_count = (end_samples + FRAMES_PER_BUFFER - 1) / FRAMES_PER_BUFFER;
+    return (buffers_count - 1) * FRAMES_PER_BUFFER;
+}
+
+// PARALLEL AND PARTIAL RENDER
+
+typedef struct {
+    float *samples; // whole song, starting at frame 0
+    uint32_t end_frame;
+    SoundState *data;
+
+    int segments_count;
+    uint32_t *segment_starts;
+    VoiceAllocator *segment_allocators; // voices at the start of each segment
+
+    atomic_int next_segment;
+    atomic_bool did_fail;
+} RenderJob;
+
+void invalidate_voice_checkpoints(VoiceCheckpoints *checkpoints, uint32_t tick) {
+    checkpoints->valid_count = fmin(checkpoints->valid_count, tick / VOICE_CHECKPOINT_TICKS + 1);
+}
+
+void free_voice_checkpoints(VoiceCheckpoints *checkpoints) {
+    free(checkpoints->allocators);
+    *checkpoints = (VoiceCheckpoints) { 0 };
+}
+
+static void record_voice_checkpoint(VoiceCheckpoints *checkpoints, int checkpoint, const VoiceAllocator *allocator) {
+    if (checkpoint >= checkpoints->capacity) {
+        checkpoints->capacity = fmax(16, checkpoints->capacity * 2);
+        checkpoints->allocators = realloc(checkpoints->allocators, sizeof(VoiceAllocator) * checkpoints->capacity);
+        assert(checkpoints->allocators != NULL && "Buy more RAM lol");
+    }
+    checkpoints->allocators[checkpoint] = *allocator;
+}
+
+// voice allocation only depends on the events, so it's replayed here without mixing anything
+// and recorded at every segment start, starting from the last checkpoint before the first segment
+static bool plan_segment_voices(RenderJob *job) {
+    SoundState *data = job->data;
+    VoiceCheckpoints *checkpoints = data->checkpoints;
+    VoiceAllocator allocator;
+    init_voice_allocator(&allocator, data->allocator.steal_policy, data->allocator.is_growable);
+
+    int event_index = 0;
+    int next_checkpoint = 0;
+    if (checkpoints != NULL) {
+        // recorded with other settings, the voices went elsewhere
+        if (checkpoints->valid_count > 0 &&
+            (checkpoints->allocators[0].steal_policy != allocator.steal_policy || checkpoints->allocators[0].is_growable != allocator.is_growable)) {
+            checkpoints->valid_count = 0;
+        }
+
+        uint32_t first_tick = job->segment_starts[0] / FRAMES_PER_TICK;
+        int checkpoint = fmin(checkpoints->valid_count - 1, first_tick / VOICE_CHECKPOINT_TICKS);
+        if (checkpoint > 0) {
+            allocator = checkpoints->allocators[checkpoint];
+
+            // first event at or after the checkpoint
+            uint32_t checkpoint_tick = checkpoint * VOICE_CHECKPOINT_TICKS;
+            int high = data->events_count;
+            while (event_index < high) {
+                int middle = event_index + (high - event_index) / 2;
+                if (data->events[middle].tick < checkpoint_tick)  event_index = middle + 1;
+                else  high = middle;
+            }
+        }
+        next_checkpoint = fmax(0, checkpoint);
+    }
+
+    int segment = 0;
+    bool success = true;
+    for (; event_index < data->events_count; event_index++) {
+        SoundEvent event = data->events[event_index];
+        uint32_t frame = event.tick * FRAMES_PER_TICK;
+
+        // events starting at the segment start are fired by the segment itself
+        while (segment < job->segments_count && job->segment_starts[segment] <= frame) {
+            job->segment_allocators[segment++] = allocator;
+        }
+        // and the ones at a checkpoint tick are not in it either
+        while (checkpoints != NULL && (uint64_t) next_checkpoint * VOICE_CHECKPOINT_TICKS <= event.tick) {
+            record_voice_checkpoint(checkpoints, next_checkpoint++, &allocator);
+        }
+        if (frame >= job->end_frame)  break;
+
+        if (event.is_on) {
+            if (allocate_voice(&allocator, event.identifier, event.key, frame) < 0) {
+                data->error_message = "MAX_POLYPHONY exceeded. Starting a midi event is impossible.";
+                printf("%s\n", data->error_message);
+                success = false;
+                break;
+            }
+        } else {
+            release_allocated_voice(&allocator, event.identifier, frame);
+        }
+    }
+
+    // the checkpoints recorded are right even when the replay stopped at a failing event
+    if (checkpoints != NULL)  checkpoints->valid_count = fmax(checkpoints->valid_count, next_checkpoint);
+    if (!success)  return false;
+
+    for (; segment < job->segments_count; segment++) {
+        job->segment_allocators[segment] = allocator;
+    }
+    data->allocator.stolen_count = allocator.stolen_count;
+    return true;
+}
+
+static bool render_segment(RenderJob *job, int segment) {
+    uint32_t start_frame = job->segment_starts[segment];
+    uint32_t end_frame = segment + 1 < job->segments_count ? job->segment_starts[segment + 1] : job->end_frame;
+
+    SoundState data = *job->data;
+    data.current_frame = start_frame;
+    data.event_cursor = 0;
+    data.allocator = job->segment_allocators[segment];
+    memset(&data.voices, 0, sizeof(data.voices));
+
+    for (int i = 0; i < data.allocator.voices_count; i++) {
+        if (is_allocated_voice_free(&data.allocator, i, start_frame))  continue;
+
+        AllocatedVoice *voice = &data.allocator.voices[i];
+        uint32_t attack_frames = (voice->is_released ? voice->release_frame : start_frame) - voice->start_frame;
+        uint32_t release_frames = voice->is_released ? start_frame - voice->release_frame : 0;
+        restore_voice(&data.voices, i, voice->key, data.waveform, voice->identifier, attack_frames, voice->is_released, release_frames);
+    }
+
+    // same buffer boundaries as the serial render, not that they matter for the output
+    while (data.current_frame < end_frame) {
+        uint32_t frames_count = fmin(FRAMES_PER_BUFFER, end_frame - data.current_frame);
+        float *buffer = &job->samples[(size_t) data.current_frame * NUMBER_OF_CHANNELS];
+        if (!create_samples_from_notes(buffer, &data, frames_count, FRAMES_PER_TICK)) {
+            job->data->error_message = data.error_message;
+            return false;
+        }
+    }
+    return true;
+}
+
+static void *render_worker(void *argument) {
+    RenderJob *job = argument;
+
+    while (!atomic_load(&job->did_fail)) {
+        int segment = atomic_fetch_add(&job->next_segment, 1);
+        if (segment >= job->segments_count)  break;
+
+        if (!render_segment(job, segment)) {
+            atomic_store(&job->did_fail, true);
+        }
+    }
+    return NULL;
+}
+
+static void run_render_job(RenderJob *job, int threads_count) {
+    if (threads_count <= 1) {
+        render_worker(job);
+        return;
+    }
+
+    pthread_t threads[MAX_RENDER_THREADS];
+    int started_count = 0;
+    while (started_count < threads_count) {
+        if (pthread_create(&threads[started_count], NULL, render_worker, job) != 0)  break;
+        started_count++;
+    }
+    // out of threads, this one takes the share of the ones that did not start
+    if (started_count < threads_count) {
+        render_worker(job);
+    }
+    for (int i = 0; i < started_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+bool render_samples(float *samples, uint32_t frames_count, SoundState *data, int threads_count) {
+    return render_samples_range(samples, 0, frames_count, data, threads_count);
+}
+
+bool render_samples_range(float *samples, uint32_t start_frame, uint32_t end_frame, SoundState *data, int threads_count) {
+    data->error_message = NULL;
+    if (start_frame >= end_frame)  return true;
+
+    int buffers_count = (end_frame - start_frame + FRAMES_PER_BUFFER - 1) / FRAMES_PER_BUFFER;
+    threads_count = fmax(1, fmin(fmin(threads_count, MAX_RENDER_THREADS), buffers_count));
+
+    RenderJob job = {
+        .samples = samples,
+        .end_frame = end_frame,
+        .data = data,
+        .segments_count = threads_count == 1 ? 1 : fmin(threads_count * SEGMENTS_PER_THREAD, buffers_count)
+    };
+    atomic_init(&job.next_segment, 0);
+    atomic_init(&job.did_fail, false);
+
+    job.segment_starts = malloc(sizeof(uint32_t) * job.segments_count);
+    job.segment_allocators = malloc(sizeof(VoiceAllocator) * job.segments_count);
+    assert(job.segment_starts != NULL && job.segment_allocators != NULL && "Buy more RAM lol");
+
+    for (int segment = 0; segment < job.segments_count; segment++) {
+        uint32_t buffers_offset = (uint64_t) buffers_count * segment / job.segments_count;
+        job.segment_starts[segment] = start_frame + buffers_offset * FRAMES_PER_BUFFER;
+    }
+
+    bool success = plan_segment_voices(&job);
+    if (success) {
+        run_render_job(&job, threads_count);
+        success = !atomic_load(&job.did_fail);
+    }
+
+    free(job.segment_starts);
+    free(job.segment_allocators);
+    return success;
+}
+
+int render_threads_count(void) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return fmax(1, fmin(count, MAX_RENDER_THREADS));
+}
@@ -0,0 +1,78 @@
+#ifndef SYNTH_INCLUDES
+#define SYNTH_INCLUDES
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "shared.h"
+#include "voices.h"
+#include "notes.h"
+
+#define VOICE_CHECKPOINT_TICKS 1024
+
+// carries what playing needs of its note, so events stay usable while the notes change or move
+typedef struct {
+    uint32_t tick;
+    int note_index; // position when the events were made, only orders events of the same tick
+    int identifier; // note_identifier of the note
+    uint8_t key;
+    bool is_on;
+} SoundEvent;
+
+// allocators recorded every VOICE_CHECKPOINT_TICKS while a render replays the events, so a later partial render
+// replays from the checkpoint before it instead of from the first event
+// checkpoint k holds the voices after every event before tick k * VOICE_CHECKPOINT_TICKS
+typedef struct {
+    VoiceAllocator *allocators;
+    int valid_count; // checkpoints [0, valid_count) match the events
+    int capacity;
+} VoiceCheckpoints;
+
+typedef struct {
+    const NoteStore *notes; // events are made from it, playing them doesn't read it
+    uint32_t current_frame;
+
+    // note on/off events sorted by tick, cursor points to the next event to fire
+    SoundEvent *events;
+    int events_count;
+    int event_cursor;
+
+    Waveform waveform;
+    VoiceAllocator allocator; // set up with init_voice_allocator, renders start from an empty one with its settings
+    VoiceCheckpoints *checkpoints; // optional, renders use and extend them
+    VoiceBank voices;
+    char *error_message;
+} SoundState;
+
+int note_identifier(Note note);
+
+// allocates events array sorted by tick, has to be freed with free_sound_events
+void create_sound_events(SoundState *data);
+
+// points event_cursor to the first event at or after current_frame, events before it are not played
+void seek_sound_events(SoundState *data);
+void free_sound_events(SoundState *data);
+
+// renders frames_per_buffer frames starting at data->current_frame, false when notes could not be played
+bool create_samples_from_notes(float *buffer, SoundState *data, uint32_t frames_per_buffer, int frames_per_tick);
+
+// length of the rendered song ending at end_tick
+uint32_t song_frames_count(uint32_t end_tick);
+
+// renders frames_count frames from the start of the song into samples
+// with threads_count > 1 the song is split into segments rendered in parallel,
+// output is bit-identical to rendering it with create_samples_from_notes block after block
+bool render_samples(float *samples, uint32_t frames_count, SoundState *data, int threads_count);
+
+// renders only [start_frame, end_frame) of the song into samples (which start at frame 0),
+// voices playing at start_frame are reconstructed by replaying the allocator over the events before it (no mixing):
+// O(events) up to start_frame, or up to VOICE_CHECKPOINT_TICKS of them with valid data->checkpoints
+// (the events themselves still come sorted from create_sound_events, O(n log n) in the notes)
+bool render_samples_range(float *samples, uint32_t start_frame, uint32_t end_frame, SoundState *data, int threads_count);
+int render_threads_count(void);
+
+// events from tick on changed, the checkpoints after it are dropped
+void invalidate_voice_checkpoints(VoiceCheckpoints *checkpoints, uint32_t tick);
+void free_voice_checkpoints(VoiceCheckpoints *checkpoints);
+
+#endif // SYNTH_INCLUDES
@@ -0,0 +1,129 @@
+#include <stdbool.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "trace.h"
+
+#define TRACE_FLUSH_NANOSECONDS 50000000 // the writer wakes up 20 times a second
+
+static const char *trace_thread_name(TraceThread thread) {
+    switch (thread) {
+        case TRACE_THREAD_UI:      return "ui";
+        case TRACE_THREAD_AUDIO:   return "audio";
+        case TRACE_THREAD_RENDER:  return "render";
+        default:                   return "unknown";
+    }
+}
+
+uint64_t trace_time(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+void trace_span(Tracer *tracer, TraceThread thread, const char *name, uint64_t start, uint64_t duration) {
+    if (tracer == NULL || !atomic_load_explicit(&tracer->is_recording, memory_order_relaxed))  return;
+
+    TraceRing *ring = &tracer->rings[thread];
+    uint32_t write_index = atomic_load_explicit(&ring->write_index, memory_order_relaxed);
+    uint32_t read_index = atomic_load_explicit(&ring->read_index, memory_order_acquire);
+    if (write_index - read_index == TRACE_RING_CAPACITY) {
+        atomic_fetch_add_explicit(&ring->dropped_count, 1, memory_order_relaxed);
+        return;
+    }
+
+    TraceSpan *span = &ring->spans[write_index & (TRACE_RING_CAPACITY - 1)];
+    strncpy(span->name, name, TRACE_NAME_LENGTH - 1);
+    span->name[TRACE_NAME_LENGTH - 1] = 0;
+    span->start = start;
+    span->duration = duration;
+    atomic_store_explicit(&ring->write_index, write_index + 1, memory_order_release);
+}
+
+// complete events ("ph": "X"), timestamps in microseconds since the recording started
+static void flush_rings(Tracer *tracer) {
+    for (int thread = 0; thread < TRACE_THREADS_COUNT; thread++) {
+        TraceRing *ring = &tracer->rings[thread];
+        uint32_t write_index = atomic_load_explicit(&ring->write_index, memory_order_acquire);
+        uint32_t read_index = atomic_load_explicit(&ring->read_index, memory_order_relaxed);
+
+        for (; read_index != write_index; read_index++) {
+            TraceSpan span = ring->spans[read_index & (TRACE_RING_CAPACITY - 1)];
+            if (span.start < tracer->start_time)  continue; // recorded before this recording was started
+
+            fprintf(tracer->file, "%s\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                    tracer->has_written_span ? "," : "", span.name, thread,
+                    (span.start - tracer->start_time) / 1e3, span.duration / 1e3);
+            tracer->has_written_span = true;
+        }
+        atomic_store_explicit(&ring->read_index, read_index, memory_order_release);
+    }
+    fflush(tracer->file);
+}
+
+static void *trace_writer_main(void *argument) {
+    Tracer *tracer = argument;
+
+    while (!atomic_load(&tracer->should_stop_writer)) {
+        flush_rings(tracer);
+        struct timespec nap = { 0, TRACE_FLUSH_NANOSECONDS };
+        nanosleep(&nap, NULL);
+    }
+    flush_rings(tracer);
+    return NULL;
+}
+
+bool start_trace(Tracer *tracer, const char *path) {
+    if (atomic_load(&tracer->is_recording))  return true;
+
+    tracer->file = fopen(path, "w");
+    if (tracer->file == NULL) {
+        printf("Error opening trace file %s.\n", path);
+        return false;
+    }
+
+    fprintf(tracer->file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    tracer->has_written_span = false;
+    for (int thread = 0; thread < TRACE_THREADS_COUNT; thread++) {
+        fprintf(tracer->file, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                tracer->has_written_span ? "," : "", thread, trace_thread_name(thread));
+        tracer->has_written_span = true;
+        atomic_store(&tracer->rings[thread].dropped_count, 0);
+    }
+
+    tracer->start_time = trace_time();
+    atomic_store(&tracer->should_stop_writer, false);
+    if (pthread_create(&tracer->writer_thread, NULL, trace_writer_main, tracer) != 0) {
+        printf("Error starting trace writer thread.\n");
+        fclose(tracer->file);
+        tracer->file = NULL;
+        return false;
+    }
+
+    atomic_store(&tracer->is_recording, true);
+    printf("Recording trace to %s\n", path);
+    return true;
+}
+
+// spans still being recorded while it stops are left in the rings, the next recording skips them
+void stop_trace(Tracer *tracer) {
+    if (!atomic_load(&tracer->is_recording))  return;
+
+    atomic_store(&tracer->is_recording, false);
+    atomic_store(&tracer->should_stop_writer, true);
+    pthread_join(tracer->writer_thread, NULL);
+
+    fprintf(tracer->file, "\n]}\n");
+    fclose(tracer->file);
+    tracer->file = NULL;
+
+    unsigned int dropped_count = 0;
+    for (int thread = 0; thread < TRACE_THREADS_COUNT; thread++) {
+        dropped_count += atomic_load(&tracer->rings[thread].dropped_count);
+    }
+    printf("Trace recording stopped, %u spans dropped\n", dropped_count);
+}
@@ -0,0 +1,57 @@
+#ifndef TRACE_INCLUDES
+#define TRACE_INCLUDES
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define TRACE_RING_CAPACITY 16384 // spans per thread between two flushes, power of two
+#define TRACE_NAME_LENGTH   24    // names are copied, the library they came from can be unloaded before the flush
+
+// every thread records into its own ring, so recording never locks
+typedef enum {
+    TRACE_THREAD_UI,
+    TRACE_THREAD_AUDIO,
+    TRACE_THREAD_RENDER,
+    TRACE_THREADS_COUNT
+} TraceThread;
+
+typedef struct {
+    char name[TRACE_NAME_LENGTH];
+    uint64_t start; // nanoseconds, same clock as trace_time
+    uint64_t duration;
+} TraceSpan;
+
+// single producer (the thread), single consumer (the writer thread), spans are dropped when it's full
+typedef struct {
+    TraceSpan spans[TRACE_RING_CAPACITY];
+    _Atomic uint32_t write_index;
+    _Atomic uint32_t read_index;
+    atomic_uint dropped_count;
+} TraceRing;
+
+// owned by the host so a recording goes on across hot reloads, the library gets a pointer to it
+// a writer thread flushes the rings into a chrome trace event json file (chrome://tracing, ui.perfetto.dev)
+typedef struct {
+    TraceRing rings[TRACE_THREADS_COUNT];
+    atomic_bool is_recording;
+    atomic_bool should_stop_writer;
+    uint64_t start_time;
+    FILE *file;
+    bool has_written_span;
+    pthread_t writer_thread;
+} Tracer;
+
+// monotonic nanoseconds
+uint64_t trace_time(void);
+
+// recording only, any thread, does nothing when tracer is NULL or not recording
+void trace_span(Tracer *tracer, TraceThread thread, const char *name, uint64_t start, uint64_t duration);
+
+// host only
+bool start_trace(Tracer *tracer, const char *path);
+void stop_trace(Tracer *tracer);
+
+#endif // TRACE_INCLUDES
@@ -8,6 +8,8 @@
 #include <time.h>
 
 #include "ui.h"
+#include "rlgl.h"
+#include "profile.h"
 
 const float theta = 0.000005f;
 int console_lines_this_frame = 0;
@@ -157,6 +159,43 @@ bool DrawButton(char* title, int id, int x, int y, int width, int height) {
     return DrawButtonRectangle(title, id, ((Rectangle) { x, y, width, height }));
 }
 
+void DrawProgressBar(char* title, float progress, Rectangle frame) {
+    progress = fmin(fmax(progress, 0), 1);
+    DrawRectangleRounded(frame, 1.0, 10, CLITERAL(Color){ 120, 120, 120, 255 });
+    if (progress * frame.width >= frame.height) { // narrower than its height it can't be rounded
+        DrawRectangleRounded((Rectangle) { frame.x, frame.y, frame.width * progress, frame.height }, 1.0, 10, CLITERAL(Color){ 200, 200, 200, 255 });
+    }
+
+    char text[64];
+    snprintf(text, sizeof(text), "%s %d%%", title, (int)(progress * 100));
+    int title_font_size = 20;
+    int text_width = MeasureText(text, title_font_size);
+    DrawText(
+        text,
+        frame.x + frame.width / 2 - text_width / 2,
+        frame.y + frame.height / 2 - title_font_size / 2,
+        title_font_size,
+        CLITERAL(Color){ 50, 50, 50, 255 }
+    );
+}
+
+void DrawRectangleBatch(Rectangle *rectangles, Color *colors, int count) {
+    if (count == 0)  return;
+
+    // same vertex order as DrawRectangleRec, rlgl starts a new batch by itself when this one is full
+    rlBegin(RL_QUADS);
+    for (int i = 0; i < count; i++) {
+        Rectangle rectangle = rectangles[i];
+        rlColor4ub(colors[i].r, colors[i].g, colors[i].b, colors[i].a);
+
+        rlVertex2f(rectangle.x, rectangle.y);
+        rlVertex2f(rectangle.x, rectangle.y + rectangle.height);
+        rlVertex2f(rectangle.x + rectangle.width, rectangle.y + rectangle.height);
+        rlVertex2f(rectangle.x + rectangle.width, rectangle.y);
+    }
+    rlEnd();
+}
+
 void DrawConsoleLine(char* string) {
     int console_width = GetScreenWidth() / 2;
     int font_size = 18;
@@ -187,3 +226,99 @@ void DrawConsoleLine(char* string) {
 void ClearConsole(void) {
     console_lines_this_frame = 0;
 }
+
+int DrawWaveformPeaks(const WaveformPeaks *peaks, const float *samples, uint32_t frames_count,
+                      Rectangle view, Rectangle background_rect, float scroll_offset,
+                      float sample_width, int skipping_frames, float wave_amplitude, bool should_draw_rms) {
+    if (frames_count == 0)  return 0;
+
+    int draw_calls_count = 0;
+    float width = sample_width * skipping_frames;
+    float right_edge = background_rect.x + background_rect.width;
+    float bottom_edge = background_rect.y + background_rect.height;
+
+    // column j covers frames since the previous column up to j * skipping_frames, only visible ones are measured
+    int first_column = fmax(0, floor(scroll_offset / width) - 1);
+    int last_column = fmin((frames_count - 1) / skipping_frames, ceil((scroll_offset + view.width) / width) + 1);
+
+    for (int j = first_column; j <= last_column; j++) {
+        int i = j * skipping_frames;
+        float x = (i - 1) * sample_width - scroll_offset + view.x;
+
+        uint32_t start_frame = j == 0 ? 0 : i - skipping_frames + 1;
+        PeakBlock peak = measure_waveform_peaks(peaks, samples, start_frame, i + 1);
+        float highest_value = fmax(fabs(peak.min), fabs(peak.max));
+        float sum = peak.sum_squares;
+
+        float height_peak = highest_value * 2 * wave_amplitude;
+        float y_peak = view.y + view.height / 2 - height_peak / 2;
+
+        float rms_value = sqrt(sum / skipping_frames) * 0.8;
+        float height_rms = rms_value * 2 * wave_amplitude;
+        float y_rms = view.y + view.height / 2 - height_rms / 2;
+
+        // check if not beyond the bounds
+        if (x > right_edge || (x + width) < view.x)  continue;
+
+        Rectangle peak_rect = (Rectangle) {
+            x,
+            fmin(bottom_edge, fmax(view.y, y_peak)),
+            width,
+            fmin(view.height, height_peak)
+        };
+        DrawRectangleRec(GetCollisionRec(background_rect, peak_rect), BLACK);
+        draw_calls_count += 1;
+
+        if (should_draw_rms) {
+            Rectangle rms_rect = (Rectangle) {
+                x,
+                fmin(bottom_edge, fmax(view.y, y_rms)),
+                width,
+                fmin(view.height, height_rms)
+            };
+            DrawRectangleRec(GetCollisionRec(background_rect, rms_rect), DARKGRAY);
+            draw_calls_count += 1;
+        }
+    }
+    return draw_calls_count;
+}
+
+void DrawProfileOverlay(float x, float y, float width) {
+    const float row_height = 44;
+    const float graph_width = width * 0.4;
+    const float frame_budget = 1000.0f / 60; // ms, sections without a deadline are compared to a 60 fps frame
+
+    DrawRectangle(x, y, width, row_height * PROFILE_SECTIONS_COUNT + 10, Fade(BLACK, 0.8f));
+
+    for (int section = 0; section < PROFILE_SECTIONS_COUNT; section++) {
+        float row_y = y + 5 + section * row_height;
+        ProfileSummary summary = summarize_profile_section(section);
+        float budget = summary.budget > 0 ? summary.budget : frame_budget;
+
+        char text[120];
+        sprintf(text, "%s  last %.2f  med %.2f  p99 %.2f  max %.2f ms",
+                profile_section_name(section), summary.last, summary.median, summary.p99, summary.max);
+        DrawText(text, x + graph_width + 15, row_y + 4, 16, WHITE);
+
+        if (summary.budget > 0) {
+            sprintf(text, "deadline %.2f ms, worst load %.0f%%", summary.budget, summary.worst_load * 100);
+            DrawText(text, x + graph_width + 15, row_y + 22, 16, summary.worst_load > 1 ? RED : LIGHTGRAY);
+        }
+
+        // bars scaled to the budget, or to the slowest sample when that's longer
+        float durations[PROFILE_HISTORY];
+        Rectangle bars[PROFILE_HISTORY];
+        Color colors[PROFILE_HISTORY];
+        int count = copy_profile_durations(section, durations, PROFILE_HISTORY);
+        float scale = (row_height - 6) / fmax(budget, summary.max);
+        float bar_width = graph_width / PROFILE_HISTORY;
+
+        for (int i = 0; i < count; i++) {
+            float height = fmax(1, durations[i] * scale);
+            bars[i] = (Rectangle) { x + 5 + (PROFILE_HISTORY - count + i) * bar_width, row_y + row_height - 4 - height, bar_width, height };
+            colors[i] = durations[i] > budget ? RED : GREEN;
+        }
+        DrawRectangleLines(x + 5, row_y + 2, graph_width, row_height - 4, DARKGRAY);
+        DrawRectangleBatch(bars, colors, count);
+    }
+}
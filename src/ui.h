@@ -1,7 +1,9 @@
 #include "raylib.h"
+#include "peaks.h"
+#include "profile.h"
 
 #define Console(Format, Arguments...) { \
-    char text[50]; \
+    char text[100]; \
     sprintf(text, Format, Arguments); \
     DrawConsoleLine((char*) text); \
 }
@@ -26,5 +28,18 @@ Rectangle calculate_content_rect(float view_x, float view_width, float view_y, f
 
 bool DrawButtonRectangle(char* title, int id, Rectangle frame);
 bool DrawButton(char* title, int id, int x, int y, int width, int height);
+void DrawProgressBar(char* title, float progress, Rectangle frame); // progress: 0.0 -> 1.0
 void DrawConsoleLine(char* string);
+
+// draws all rectangles as quads of a single rlgl batch
+void DrawRectangleBatch(Rectangle *rectangles, Color *colors, int count);
 void ClearConsole(void);
+
+// zoomed out waveform: a bar for the peak of every column of skipping_frames frames and a smaller one for its rms,
+// only visible columns are measured, returns the number of draw calls
+int DrawWaveformPeaks(const WaveformPeaks *peaks, const float *samples, uint32_t frames_count,
+                      Rectangle view, Rectangle background_rect, float scroll_offset,
+                      float sample_width, int skipping_frames, float wave_amplitude, bool should_draw_rms);
+
+// a row per profiled section: recent durations as a bar graph and their percentiles
+void DrawProfileOverlay(float x, float y, float width);
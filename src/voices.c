@@ -0,0 +1,551 @@
+#include <stdbool.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "voices.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VOICES_X86 1
+#include <immintrin.h>
+#endif
+
+#define VOICES_GROUP 8 // lanes of the widest kernel, every kernel sums voices in the same order
+
+// wavetables: one band-limited cycle per waveform and octave of keys
+// the top bits of the phase index the table, the rest interpolates between two entries
+#define WAVETABLE_BITS      11
+#define WAVETABLE_SIZE      (1 << WAVETABLE_BITS)
+#define WAVETABLE_STRIDE    (WAVETABLE_SIZE + 1) // guard entry repeats the first one for interpolation
+#define WAVETABLE_BANDS     11 // 128 keys / 12 keys per band
+#define FRACTION_BITS       (32 - WAVETABLE_BITS)
+#define FRACTION_MASK       ((1u << FRACTION_BITS) - 1)
+
+static_assert(MAX_POLYPHONY % VOICES_GROUP == 0, "MAX_POLYPHONY has to be a multiple of 8");
+static_assert(VOICES_CAPACITY % VOICES_GROUP == 0 && VOICES_CAPACITY / VOICES_GROUP <= 32, "Active groups have to fit a 32 bit mask");
+static_assert(VOICES_CAPACITY >= MAX_POLYPHONY && VOICES_CAPACITY <= INT16_MAX, "VOICES_CAPACITY out of range");
+static_assert((VOICE_MAP_SIZE & (VOICE_MAP_SIZE - 1)) == 0 && VOICE_MAP_SIZE >= VOICES_CAPACITY * 2, "VOICE_MAP_SIZE has to be a power of two");
+
+static const float attack_step = 1.0f / (SAMPLE_RATE / 25);
+static const float release_step = 1.0f / (SAMPLE_RATE / 100);
+static const float fraction_scale = 1.0f / (1u << FRACTION_BITS);
+
+static float wavetables[WAVEFORMS_COUNT * WAVETABLE_BANDS * WAVETABLE_STRIDE];
+static uint32_t key_phase_increments[128];
+
+// gain after n attack frames, it stays at 1.0 after attack_length frames
+// and how long the release takes when the voice is released at that gain
+#define ATTACK_GAINS_CAPACITY 2048
+static float attack_gains[ATTACK_GAINS_CAPACITY];
+static uint32_t release_lengths[ATTACK_GAINS_CAPACITY + 1];
+static uint32_t attack_length;
+
+typedef void (*MixVoicesKernel)(VoiceBank *bank, float *buffer, uint32_t frames_count);
+
+static MixVoicesKernel mix_kernel = NULL;
+static const char *mix_kernel_name = NULL;
+
+// WAVETABLES
+
+static double key_frequency(int key) {
+    return pow(2.0, (key - 69) / 12.0) * 440.0;
+}
+
+// fourier series coefficients of sin(harmonic * x)
+static double harmonic_amplitude(Waveform waveform, int harmonic) {
+    bool is_odd = harmonic % 2 == 1;
+
+    switch (waveform) {
+        case WAVEFORM_SINE:
+            return harmonic == 1 ? 1.0 : 0.0;
+        case WAVEFORM_SAW:
+            return (is_odd ? 2.0 : -2.0) / (M_PI * harmonic);
+        case WAVEFORM_SQUARE:
+            return is_odd ? 4.0 / (M_PI * harmonic) : 0.0;
+        case WAVEFORM_TRIANGLE:
+            if (!is_odd)  return 0.0;
+            return ((harmonic / 2) % 2 == 0 ? 8.0 : -8.0) / (M_PI * M_PI * harmonic * harmonic);
+        default:
+            assert(false && "Unknown waveform.");
+            return 0.0;
+    }
+}
+
+static void create_wavetables(void) {
+    // sin(h * x) at table points is a lookup into a single sine cycle
+    static double sine[WAVETABLE_SIZE];
+    for (int i = 0; i < WAVETABLE_SIZE; i++) {
+        sine[i] = sin(2 * M_PI * i / WAVETABLE_SIZE);
+    }
+
+    double sums[WAVETABLE_SIZE];
+    for (int waveform = 0; waveform < WAVEFORMS_COUNT; waveform++) {
+        for (int band = 0; band < WAVETABLE_BANDS; band++) {
+            // highest key of the band must not alias
+            double top_frequency = key_frequency(fmin(127, band * 12 + 11));
+            int harmonics_count = fmax(1, fmin(WAVETABLE_SIZE / 2 - 1, (SAMPLE_RATE / 2) / top_frequency));
+
+            memset(sums, 0, sizeof(sums));
+            for (int harmonic = 1; harmonic <= harmonics_count; harmonic++) {
+                double amplitude = harmonic_amplitude(waveform, harmonic);
+                if (amplitude == 0.0)  continue;
+
+                for (int i = 0; i < WAVETABLE_SIZE; i++) {
+                    sums[i] += amplitude * sine[(harmonic * i) % WAVETABLE_SIZE];
+                }
+            }
+
+            float *table = &wavetables[(waveform * WAVETABLE_BANDS + band) * WAVETABLE_STRIDE];
+            for (int i = 0; i < WAVETABLE_SIZE; i++) {
+                table[i] = (float) sums[i];
+            }
+            table[WAVETABLE_SIZE] = table[0];
+        }
+    }
+
+    for (int key = 0; key < 128; key++) {
+        key_phase_increments[key] = (uint32_t) llround(key_frequency(key) / SAMPLE_RATE * 4294967296.0);
+    }
+}
+
+// VOICES
+
+void start_voice(VoiceBank *bank, int index, uint8_t key, Waveform waveform, int identifier) {
+    if (mix_kernel == NULL)  init_voices();
+    assert(key < 128);
+    assert(waveform < WAVEFORMS_COUNT);
+
+    bank->phase[index] = 0;
+    bank->phase_increment[index] = key_phase_increments[key];
+    bank->table_offset[index] = (waveform * WAVETABLE_BANDS + key / 12) * WAVETABLE_STRIDE;
+    bank->gain[index] = 0.0f;
+    bank->gain_step[index] = attack_step;
+    bank->identifier[index] = identifier;
+    if (index >= bank->voices_count)  bank->voices_count = index + 1;
+}
+
+// same float operations as the mix kernels
+static float release_gain(float gain, uint32_t release_frames) {
+    for (uint32_t i = 0; i < release_frames && gain > 0.0f; i++) {
+        gain = fminf(fmaxf(gain - release_step, 0.0f), 1.0f);
+    }
+    return gain;
+}
+
+static void create_attack_gains(void) {
+    float gain = 0.0f;
+    attack_length = 0;
+
+    while (gain < 1.0f) {
+        assert(attack_length < ATTACK_GAINS_CAPACITY);
+        attack_gains[attack_length++] = gain;
+        gain = fminf(fmaxf(gain + attack_step, 0.0f), 1.0f);
+    }
+
+    // last entry is for the full gain
+    for (uint32_t i = 0; i <= attack_length; i++) {
+        float gain = i < attack_length ? attack_gains[i] : 1.0f;
+
+        release_lengths[i] = 0;
+        while (gain > 0.0f) {
+            gain = release_gain(gain, 1);
+            release_lengths[i] += 1;
+        }
+    }
+}
+
+float attack_gain(uint32_t attack_frames) {
+    if (mix_kernel == NULL)  init_voices();
+    return attack_frames < attack_length ? attack_gains[attack_frames] : 1.0f;
+}
+
+uint32_t release_length(uint32_t attack_frames) {
+    if (mix_kernel == NULL)  init_voices();
+    return release_lengths[attack_frames < attack_length ? attack_frames : attack_length];
+}
+
+void restore_voice(VoiceBank *bank, int index, uint8_t key, Waveform waveform, int identifier,
+                   uint32_t attack_frames, bool is_released, uint32_t release_frames) {
+    start_voice(bank, index, key, waveform, identifier);
+
+    // a playing voice is mixed every frame, so its phase is exact multiple of the increment
+    bank->phase[index] = bank->phase_increment[index] * (attack_frames + release_frames);
+    bank->gain[index] = attack_gain(attack_frames);
+
+    if (is_released) {
+        bank->gain[index] = release_gain(bank->gain[index], release_frames);
+        bank->gain_step[index] = -release_step;
+    }
+}
+
+void release_voice(VoiceBank *bank, int index) {
+    bank->gain_step[index] = -release_step;
+}
+
+bool is_voice_free(VoiceBank *bank, int index) {
+    return bank->gain[index] <= 0.0f && bank->gain_step[index] <= 0.0f;
+}
+
+// groups with only silent voices are skipped for the whole call, their phase does not matter
+static uint32_t active_groups_mask(VoiceBank *bank) {
+    uint32_t mask = 0;
+    for (int i = 0; i < bank->voices_count; i++) {
+        if (!is_voice_free(bank, i))  mask |= 1u << (i / VOICES_GROUP);
+    }
+    return mask;
+}
+
+static int groups_count(VoiceBank *bank) {
+    return (bank->voices_count + VOICES_GROUP - 1) / VOICES_GROUP;
+}
+
+static void write_frame(float *buffer, float value) {
+    for (int channel = 0; channel < NUMBER_OF_CHANNELS; channel++) {
+        buffer[channel] = value;
+    }
+}
+
+// ALLOCATION
+
+static uint32_t map_slot(int identifier) {
+    return ((uint32_t) identifier * 2654435769u) & (VOICE_MAP_SIZE - 1);
+}
+
+static void map_insert(VoiceAllocator *allocator, int identifier, int index) {
+    uint32_t slot = map_slot(identifier);
+    while (allocator->map_voices[slot] != 0)  slot = (slot + 1) & (VOICE_MAP_SIZE - 1);
+
+    allocator->map_identifiers[slot] = identifier;
+    allocator->map_voices[slot] = index + 1;
+}
+
+// slot of the first entry with this identifier (notes can share one), -1 when there is none
+static int map_find(VoiceAllocator *allocator, int identifier) {
+    for (uint32_t slot = map_slot(identifier); allocator->map_voices[slot] != 0; slot = (slot + 1) & (VOICE_MAP_SIZE - 1)) {
+        if (allocator->map_identifiers[slot] == identifier)  return slot;
+    }
+    return -1;
+}
+
+// shifts the following entries back instead of leaving a tombstone, so lookups never get longer
+static void map_remove(VoiceAllocator *allocator, uint32_t slot) {
+    uint32_t empty = slot;
+    for (uint32_t next = (slot + 1) & (VOICE_MAP_SIZE - 1); allocator->map_voices[next] != 0; next = (next + 1) & (VOICE_MAP_SIZE - 1)) {
+        uint32_t home = map_slot(allocator->map_identifiers[next]);
+
+        // entry can move to the empty slot only when that's not before its home slot
+        bool can_move = (next - home) % VOICE_MAP_SIZE >= (next - empty) % VOICE_MAP_SIZE;
+        if (!can_move)  continue;
+
+        allocator->map_identifiers[empty] = allocator->map_identifiers[next];
+        allocator->map_voices[empty] = allocator->map_voices[next];
+        empty = next;
+    }
+    allocator->map_voices[empty] = 0;
+}
+
+void init_voice_allocator(VoiceAllocator *allocator, StealPolicy steal_policy, bool is_growable) {
+    memset(allocator, 0, sizeof(*allocator));
+    allocator->steal_policy = steal_policy;
+    allocator->is_growable = is_growable;
+}
+
+bool is_allocated_voice_free(VoiceAllocator *allocator, int index, uint32_t frame) {
+    AllocatedVoice *voice = &allocator->voices[index];
+    return index >= allocator->voices_count || (voice->is_released && voice->free_frame <= frame);
+}
+
+// approximates the release with a straight line, the policy only needs the order
+static float allocated_voice_gain(AllocatedVoice *voice, uint32_t frame) {
+    if (!voice->is_released)  return attack_gain(frame - voice->start_frame);
+
+    float gain = attack_gain(voice->release_frame - voice->start_frame) - (frame - voice->release_frame) * release_step;
+    return fmaxf(gain, 0.0f);
+}
+
+// every voice is busy here
+static int choose_stolen_voice(VoiceAllocator *allocator, uint32_t frame) {
+    if (allocator->steal_policy == STEAL_NONE)  return -1;
+    int chosen = 0;
+
+    for (int i = 1; i < allocator->voices_count; i++) {
+        AllocatedVoice *voice = &allocator->voices[i];
+        AllocatedVoice *best = &allocator->voices[chosen];
+        bool is_older = voice->start_frame < best->start_frame;
+
+        switch (allocator->steal_policy) {
+            case STEAL_OLDEST:
+                if (is_older)  chosen = i;
+                break;
+            case STEAL_QUIETEST: {
+                float gain = allocated_voice_gain(voice, frame);
+                float best_gain = allocated_voice_gain(best, frame);
+                if (gain < best_gain || (gain == best_gain && is_older))  chosen = i;
+                break;
+            }
+            case STEAL_RELEASING_FIRST:
+                if (voice->is_released != best->is_released) {
+                    if (voice->is_released)  chosen = i;
+                } else if (voice->is_released ? voice->release_frame < best->release_frame : is_older) {
+                    chosen = i;
+                }
+                break;
+            default:
+                assert(false && "Unknown steal policy.");
+        }
+    }
+    return chosen;
+}
+
+int allocate_voice(VoiceAllocator *allocator, int identifier, uint8_t key, uint32_t frame) {
+    if (mix_kernel == NULL)  init_voices();
+
+    int index = 0;
+    while (index < allocator->voices_count && !is_allocated_voice_free(allocator, index, frame))  index++;
+
+    int capacity = allocator->is_growable ? VOICES_CAPACITY : MAX_POLYPHONY;
+    if (index == capacity) {
+        index = choose_stolen_voice(allocator, frame);
+        if (index < 0)  return -1;
+
+        // the stolen note won't get its release anymore
+        AllocatedVoice *stolen = &allocator->voices[index];
+        if (!stolen->is_released) {
+            int slot = map_find(allocator, stolen->identifier);
+            while (allocator->map_voices[slot] != index + 1) {
+                slot = (slot + 1) & (VOICE_MAP_SIZE - 1);
+            }
+            map_remove(allocator, slot);
+        }
+        allocator->stolen_count += 1;
+    }
+
+    if (index == allocator->voices_count)  allocator->voices_count += 1;
+    allocator->voices[index] = (AllocatedVoice) {
+        .identifier = identifier,
+        .key = key,
+        .start_frame = frame
+    };
+    map_insert(allocator, identifier, index);
+    return index;
+}
+
+int release_allocated_voice(VoiceAllocator *allocator, int identifier, uint32_t frame) {
+    int slot = map_find(allocator, identifier);
+    if (slot < 0)  return -1;
+
+    int index = allocator->map_voices[slot] - 1;
+    map_remove(allocator, slot);
+
+    AllocatedVoice *voice = &allocator->voices[index];
+    voice->is_released = true;
+    voice->release_frame = frame;
+    voice->free_frame = frame + release_length(frame - voice->start_frame);
+    return index;
+}
+
+// SCALAR
+
+static float wavetable_value(uint32_t table_offset, uint32_t phase) {
+    const float *entry = &wavetables[table_offset + (phase >> FRACTION_BITS)];
+    float fraction = (float) (int32_t) (phase & FRACTION_MASK) * fraction_scale;
+    return entry[0] + fraction * (entry[1] - entry[0]);
+}
+
+// sums 8 lanes the same way the sse and avx2 kernels do
+static float sum_lanes(float *lanes) {
+    float a = (lanes[0] + lanes[4]) + (lanes[2] + lanes[6]);
+    float b = (lanes[1] + lanes[5]) + (lanes[3] + lanes[7]);
+    return a + b;
+}
+
+static void mix_voices_scalar(VoiceBank *bank, float *buffer, uint32_t frames_count) {
+    uint32_t groups = active_groups_mask(bank);
+
+    for (uint32_t frame = 0; frame < frames_count; frame++) {
+        float lanes[VOICES_GROUP] = { 0 };
+
+        for (int group = 0; group < groups_count(bank); group++) {
+            if (!(groups & (1u << group)))  continue;
+
+            for (int lane = 0; lane < VOICES_GROUP; lane++) {
+                int i = group * VOICES_GROUP + lane;
+
+                uint32_t phase = bank->phase[i] + bank->phase_increment[i];
+                bank->phase[i] = phase;
+
+                float gain = fminf(fmaxf(bank->gain[i] + bank->gain_step[i], 0.0f), 1.0f);
+                bank->gain[i] = gain;
+
+                lanes[lane] += wavetable_value(bank->table_offset[i], phase) * gain;
+            }
+        }
+
+        write_frame(&buffer[frame * NUMBER_OF_CHANNELS], sum_lanes(lanes) / MAX_POLYPHONY);
+    }
+}
+
+#ifdef VOICES_X86
+
+// SSE2
+
+__attribute__((target("sse2")))
+static __m128 advance_voices_sse(VoiceBank *bank, int i) {
+    __m128i phase = _mm_add_epi32(
+        _mm_loadu_si128((__m128i*) &bank->phase[i]),
+        _mm_loadu_si128((__m128i*) &bank->phase_increment[i])
+    );
+    _mm_storeu_si128((__m128i*) &bank->phase[i], phase);
+
+    // no gather in sse: look up the 4 entries one by one
+    uint32_t index[4];
+    __m128i offset = _mm_loadu_si128((__m128i*) &bank->table_offset[i]);
+    _mm_storeu_si128((__m128i*) index, _mm_add_epi32(_mm_srli_epi32(phase, FRACTION_BITS), offset));
+    __m128 value0 = _mm_setr_ps(wavetables[index[0]], wavetables[index[1]], wavetables[index[2]], wavetables[index[3]]);
+    __m128 value1 = _mm_setr_ps(wavetables[index[0] + 1], wavetables[index[1] + 1], wavetables[index[2] + 1], wavetables[index[3] + 1]);
+
+    __m128 fraction = _mm_mul_ps(
+        _mm_cvtepi32_ps(_mm_and_si128(phase, _mm_set1_epi32(FRACTION_MASK))),
+        _mm_set1_ps(fraction_scale)
+    );
+    __m128 value = _mm_add_ps(value0, _mm_mul_ps(fraction, _mm_sub_ps(value1, value0)));
+
+    __m128 gain = _mm_add_ps(_mm_loadu_ps(&bank->gain[i]), _mm_loadu_ps(&bank->gain_step[i]));
+    gain = _mm_min_ps(_mm_max_ps(gain, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+    _mm_storeu_ps(&bank->gain[i], gain);
+
+    return _mm_mul_ps(value, gain);
+}
+
+__attribute__((target("sse2")))
+static void mix_voices_sse(VoiceBank *bank, float *buffer, uint32_t frames_count) {
+    uint32_t groups = active_groups_mask(bank);
+
+    for (uint32_t frame = 0; frame < frames_count; frame++) {
+        __m128 low = _mm_setzero_ps();
+        __m128 high = _mm_setzero_ps();
+
+        for (int group = 0; group < groups_count(bank); group++) {
+            if (!(groups & (1u << group)))  continue;
+
+            int i = group * VOICES_GROUP;
+            low = _mm_add_ps(low, advance_voices_sse(bank, i));
+            high = _mm_add_ps(high, advance_voices_sse(bank, i + 4));
+        }
+
+        __m128 sum = _mm_add_ps(low, high);
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+
+        write_frame(&buffer[frame * NUMBER_OF_CHANNELS], _mm_cvtss_f32(sum) / MAX_POLYPHONY);
+    }
+}
+
+// AVX2
+
+__attribute__((target("avx2")))
+static void mix_voices_avx2(VoiceBank *bank, float *buffer, uint32_t frames_count) {
+    const __m256i fraction_mask = _mm256_set1_epi32(FRACTION_MASK);
+    const __m256 scale = _mm256_set1_ps(fraction_scale);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    uint32_t groups = active_groups_mask(bank);
+
+    for (uint32_t frame = 0; frame < frames_count; frame++) {
+        __m256 lanes = _mm256_setzero_ps();
+
+        for (int group = 0; group < groups_count(bank); group++) {
+            if (!(groups & (1u << group)))  continue;
+            int i = group * VOICES_GROUP;
+
+            __m256i phase = _mm256_add_epi32(
+                _mm256_loadu_si256((__m256i*) &bank->phase[i]),
+                _mm256_loadu_si256((__m256i*) &bank->phase_increment[i])
+            );
+            _mm256_storeu_si256((__m256i*) &bank->phase[i], phase);
+
+            __m256i index = _mm256_add_epi32(
+                _mm256_srli_epi32(phase, FRACTION_BITS),
+                _mm256_loadu_si256((__m256i*) &bank->table_offset[i])
+            );
+            __m256 value0 = _mm256_i32gather_ps(wavetables, index, 4);
+            __m256 value1 = _mm256_i32gather_ps(wavetables + 1, index, 4);
+
+            // no fma on purpose, results have to match the other kernels
+            __m256 fraction = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(phase, fraction_mask)), scale);
+            __m256 value = _mm256_add_ps(value0, _mm256_mul_ps(fraction, _mm256_sub_ps(value1, value0)));
+
+            __m256 gain = _mm256_add_ps(_mm256_loadu_ps(&bank->gain[i]), _mm256_loadu_ps(&bank->gain_step[i]));
+            gain = _mm256_min_ps(_mm256_max_ps(gain, _mm256_setzero_ps()), one);
+            _mm256_storeu_ps(&bank->gain[i], gain);
+
+            lanes = _mm256_add_ps(lanes, _mm256_mul_ps(value, gain));
+        }
+
+        __m128 sum = _mm_add_ps(_mm256_castps256_ps128(lanes), _mm256_extractf128_ps(lanes, 1));
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+
+        write_frame(&buffer[frame * NUMBER_OF_CHANNELS], _mm_cvtss_f32(sum) / MAX_POLYPHONY);
+    }
+}
+
+#endif // VOICES_X86
+
+// DISPATCH
+
+void init_voices(void) {
+    if (mix_kernel != NULL)  return;
+    create_wavetables();
+    create_attack_gains();
+
+    MixVoicesKernel kernel = mix_voices_scalar;
+    mix_kernel_name = "scalar";
+
+#ifdef VOICES_X86
+    __builtin_cpu_init();
+    if (getenv("MISEQ_SCALAR_VOICES") != NULL) {
+        // keep scalar
+    } else if (__builtin_cpu_supports("avx2")) {
+        kernel = mix_voices_avx2;
+        mix_kernel_name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        kernel = mix_voices_sse;
+        mix_kernel_name = "sse2";
+    }
+#endif
+
+    mix_kernel = kernel;
+}
+
+void mix_voices(VoiceBank *bank, float *buffer, uint32_t frames_count) {
+    if (mix_kernel == NULL)  init_voices();
+    mix_kernel(bank, buffer, frames_count);
+}
+
+const char *mix_voices_kernel_name(void) {
+    if (mix_kernel == NULL)  init_voices();
+    return mix_kernel_name;
+}
+
+const char *waveform_name(Waveform waveform) {
+    switch (waveform) {
+        case WAVEFORM_SINE:      return "sine";
+        case WAVEFORM_SAW:       return "saw";
+        case WAVEFORM_SQUARE:    return "square";
+        case WAVEFORM_TRIANGLE:  return "triangle";
+        default:                 return "unknown";
+    }
+}
+
+const char *steal_policy_name(StealPolicy policy) {
+    switch (policy) {
+        case STEAL_NONE:             return "off";
+        case STEAL_OLDEST:           return "oldest";
+        case STEAL_QUIETEST:         return "quietest";
+        case STEAL_RELEASING_FIRST:  return "releasing";
+        default:                     return "unknown";
+    }
+}
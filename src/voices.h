@@ -0,0 +1,103 @@
+#ifndef VOICES_INCLUDES
+#define VOICES_INCLUDES
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "shared.h"
+
+typedef enum {
+    WAVEFORM_SINE,
+    WAVEFORM_SAW,
+    WAVEFORM_SQUARE,
+    WAVEFORM_TRIANGLE,
+    WAVEFORMS_COUNT
+} Waveform;
+
+// what happens to a new note when every voice is busy
+typedef enum {
+    STEAL_NONE,            // the note can not be played, rendering fails
+    STEAL_OLDEST,          // the voice started first
+    STEAL_QUIETEST,        // the voice with the lowest envelope gain
+    STEAL_RELEASING_FIRST, // the voice released first, the oldest one when nothing is releasing
+    STEAL_POLICIES_COUNT
+} StealPolicy;
+
+// a growable pool starts more voices up to VOICES_CAPACITY before stealing, otherwise it's MAX_POLYPHONY voices
+// the mix is still divided by MAX_POLYPHONY, so more loud voices than that can clip
+#define VOICES_CAPACITY 256
+#define VOICE_MAP_SIZE  (VOICES_CAPACITY * 2) // power of two, at most half full
+
+// structure of arrays: mix kernels process 4 (sse) or 8 (avx2) voices at once
+// phase is a 32 bit fixed point fraction of the wave cycle, it wraps around by overflowing
+// gain_step > 0 attack, gain_step < 0 release, voice is free when it's silent and not attacking
+typedef struct {
+    uint32_t phase[VOICES_CAPACITY];
+    uint32_t phase_increment[VOICES_CAPACITY];
+    uint32_t table_offset[VOICES_CAPACITY];
+    float gain[VOICES_CAPACITY];
+    float gain_step[VOICES_CAPACITY];
+    int identifier[VOICES_CAPACITY];
+    int voices_count; // voices above it were never started and are not mixed
+} VoiceBank;
+
+// which note plays in which voice, decided from frames alone so a render can replay it
+// without mixing anything (parallel and partial render)
+typedef struct {
+    int identifier;
+    uint8_t key;
+    bool is_released;
+    uint32_t start_frame;
+    uint32_t release_frame;
+    uint32_t free_frame; // set on release, the voice is silent from there on
+} AllocatedVoice;
+
+// zeroed allocator is empty, doesn't steal and doesn't grow
+typedef struct {
+    StealPolicy steal_policy;
+    bool is_growable;
+    int voices_count; // voices used so far, the rest was never started
+    int stolen_count;
+    AllocatedVoice voices[VOICES_CAPACITY];
+
+    // held notes: note identifier -> voice index + 1, 0 is an empty entry, linear probing
+    int map_identifiers[VOICE_MAP_SIZE];
+    int16_t map_voices[VOICE_MAP_SIZE];
+} VoiceAllocator;
+
+// builds wavetables and picks a mix kernel, called lazily by the functions below
+void init_voices(void);
+
+void start_voice(VoiceBank *bank, int index, uint8_t key, Waveform waveform, int identifier);
+
+// puts a voice into the exact state it has after attack_frames mixed frames followed by release_frames
+// (is_released == false: still attacking), as if it was started with start_voice and mixed since then
+void restore_voice(VoiceBank *bank, int index, uint8_t key, Waveform waveform, int identifier,
+                   uint32_t attack_frames, bool is_released, uint32_t release_frames);
+
+void release_voice(VoiceBank *bank, int index);
+bool is_voice_free(VoiceBank *bank, int index);
+
+// envelope gain after attack_frames mixed frames
+// and frames until the voice is silent when it's released at that point
+float attack_gain(uint32_t attack_frames);
+uint32_t release_length(uint32_t attack_frames);
+
+void init_voice_allocator(VoiceAllocator *allocator, StealPolicy steal_policy, bool is_growable);
+
+// voice for a note starting at frame, a free one or a stolen one; -1 when the pool is full and stealing is off
+int allocate_voice(VoiceAllocator *allocator, int identifier, uint8_t key, uint32_t frame);
+
+// voice of the held note with this identifier, -1 when there is none (it was stolen or already released)
+int release_allocated_voice(VoiceAllocator *allocator, int identifier, uint32_t frame);
+bool is_allocated_voice_free(VoiceAllocator *allocator, int index, uint32_t frame);
+
+// advances voices by frames_count frames and writes their mix to interleaved buffer
+void mix_voices(VoiceBank *bank, float *buffer, uint32_t frames_count);
+
+// name of the mix kernel picked for this cpu
+const char *mix_voices_kernel_name(void);
+const char *waveform_name(Waveform waveform);
+const char *steal_policy_name(StealPolicy policy);
+
+#endif // VOICES_INCLUDES
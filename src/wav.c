@@ -1,5 +1,3 @@
-#include "raylib.h"
-
 #include <stdbool.h>
 #include <assert.h>
 #include <stdlib.h>
@@ -8,22 +6,277 @@
 #include <string.h>
 #include <math.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "shared.h"
 #include "wav.h"
 
-void save_notes_wave_file(void* samples, int samples_count, char *filename) {
-    Wave wave = (Wave) {
-        .frameCount = samples_count,
-        .sampleRate = SAMPLE_RATE,
-        .sampleSize = 32, // NOTE: I don't know why this has to be 32 and not sizeof(float) like in another place. but this works and I did not yet have time to explore this mystery
-        .channels = NUMBER_OF_CHANNELS,
-        .data = samples
-    };
-
-    ExportWave(wave, filename);
-    printf("Samples exported: %d\n", wave.frameCount);
-    printf("Sample rate: %d\n", wave.sampleRate);
-    printf("Channels: %d\n", wave.channels);
-    printf("Sample size: %d\n", wave.sampleSize);
+#if defined(__x86_64__) || defined(__i386__)
+#define WAV_X86 1
+#include <immintrin.h>
+#endif
+
+#define WAV_HEADER_SIZE 44
+#define RIFF_SIZE_OFFSET 4
+#define DATA_SIZE_OFFSET 40
+
+// converts count samples into bytes_per_sample little endian integers,
+// sample i draws its dither from generator i % WAV_DITHER_LANES
+typedef void (*ConvertSamplesKernel)(uint8_t *output, const float *samples, uint32_t count, uint32_t *dither_state,
+                                     float scale, int bytes_per_sample);
+
+static ConvertSamplesKernel convert_kernel = NULL;
+static const char *convert_kernel_name = NULL;
+
+static int bytes_per_sample(WavFormat format) {
+    switch (format) {
+        case WAV_PCM16:  return 2;
+        case WAV_PCM24:  return 3;
+        default:         return 4;
+    }
+}
+
+static float full_scale(WavFormat format) {
+    switch (format) {
+        case WAV_PCM16:  return 32767.0f;
+        case WAV_PCM24:  return 8388607.0f;
+        default:         return 1.0f;
+    }
+}
+
+// CONVERSION
+
+static inline uint32_t next_random(uint32_t *state) { // xorshift32
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static const float random_scale = 1.0f / (1 << 24);
+
+// the difference of two uniform values in [0, 1) has a triangular distribution over (-1, 1)
+static void convert_samples_scalar(uint8_t *output, const float *samples, uint32_t count, uint32_t *dither_state,
+                                   float scale, int bytes_per_sample) {
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t *state = &dither_state[i % WAV_DITHER_LANES];
+        float random1 = (float)(next_random(state) >> 8) * random_scale;
+        float random2 = (float)(next_random(state) >> 8) * random_scale;
+
+        float value = samples[i] * scale + (random1 - random2);
+        value = fminf(fmaxf(value, -scale - 1), scale);
+        int32_t integer = lrintf(value);
+
+        for (int byte = 0; byte < bytes_per_sample; byte++) {
+            *output++ = (uint8_t)(integer >> (byte * 8));
+        }
+    }
+}
+
+#ifdef WAV_X86
+
+__attribute__((target("avx2")))
+static inline __m256i next_randoms_avx2(__m256i *state) {
+    __m256i x = *state;
+    x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 13));
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 17));
+    x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 5));
+    *state = x;
+    return x;
+}
+
+// same float operations as the scalar kernel, rounding to nearest even like lrintf
+__attribute__((target("avx2")))
+static void convert_samples_avx2(uint8_t *output, const float *samples, uint32_t count, uint32_t *dither_state,
+                                 float scale, int bytes_per_sample) {
+    __m256i state = _mm256_loadu_si256((__m256i*) dither_state);
+    const __m256 scales = _mm256_set1_ps(scale);
+    const __m256 randoms_scale = _mm256_set1_ps(random_scale);
+    const __m256 low = _mm256_set1_ps(-scale - 1);
+    uint32_t vector_count = count / WAV_DITHER_LANES * WAV_DITHER_LANES;
+
+    for (uint32_t i = 0; i < vector_count; i += WAV_DITHER_LANES) {
+        __m256 random1 = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(next_randoms_avx2(&state), 8)), randoms_scale);
+        __m256 random2 = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(next_randoms_avx2(&state), 8)), randoms_scale);
+
+        __m256 value = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(&samples[i]), scales), _mm256_sub_ps(random1, random2));
+        value = _mm256_min_ps(_mm256_max_ps(value, low), scales);
+        __m256i integers = _mm256_cvtps_epi32(value);
+
+        if (bytes_per_sample == 2) {
+            // packs_epi32 works on each 128 bit half, the permute puts the two halves together
+            __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(integers, integers), 0x08);
+            _mm_storeu_si128((__m128i*) output, _mm256_castsi256_si128(packed));
+            output += 16;
+        } else {
+            // the low 3 bytes of every integer
+            const __m256i shuffle = _mm256_setr_epi8(
+                0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1
+            );
+            __m256i packed = _mm256_shuffle_epi8(integers, shuffle);
+            memcpy(output, &packed, 12);
+            memcpy(output + 12, (uint8_t*) &packed + 16, 12);
+            output += 24;
+        }
+    }
+
+    _mm256_storeu_si256((__m256i*) dither_state, state);
+    convert_samples_scalar(output, samples + vector_count, count - vector_count, dither_state, scale, bytes_per_sample);
+}
+
+#endif // WAV_X86
+
+static void init_convert_kernel(void) {
+    if (convert_kernel != NULL)  return;
+
+    ConvertSamplesKernel kernel = convert_samples_scalar;
+    convert_kernel_name = "scalar";
+
+#ifdef WAV_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernel = convert_samples_avx2;
+        convert_kernel_name = "avx2";
+    }
+#endif
+
+    convert_kernel = kernel;
+}
+
+const char *wav_convert_kernel_name(void) {
+    if (convert_kernel == NULL)  init_convert_kernel();
+    return convert_kernel_name;
+}
+
+// WRITING
+
+static void flush_wav_writer(WavWriter *writer) {
+    int offset = 0;
+    while (!writer->did_fail && offset < writer->buffer_size) {
+        ssize_t written = write(writer->file, writer->buffer + offset, writer->buffer_size - offset);
+        if (written <= 0)  writer->did_fail = true;
+        else offset += written;
+    }
+    writer->buffer_size = 0;
+}
+
+static void put_uint32(uint8_t *bytes, uint32_t value) {
+    bytes[0] = value;
+    bytes[1] = value >> 8;
+    bytes[2] = value >> 16;
+    bytes[3] = value >> 24;
+}
+
+static void put_uint16(uint8_t *bytes, uint16_t value) {
+    bytes[0] = value;
+    bytes[1] = value >> 8;
+}
+
+bool open_wav_writer(WavWriter *writer, const char *filename, WavFormat format) {
+    if (convert_kernel == NULL)  init_convert_kernel();
+    *writer = (WavWriter) { .format = format };
+
+    writer->file = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (writer->file < 0) {
+        printf("Error opening file %s.\n", filename);
+        return false;
+    }
+
+    int result = posix_memalign((void **) &writer->buffer, 4096, WAV_WRITE_BUFFER_SIZE);
+    assert(result == 0 && writer->buffer != NULL && "Buy more RAM lol");
+
+    // fixed seeds, the same song always makes the same file
+    for (int lane = 0; lane < WAV_DITHER_LANES; lane++) {
+        writer->dither_state[lane] = 0x9E3779B9u * (lane + 1);
+    }
+
+    // riff and data sizes are patched by close_wav_writer
+    int sample_size = bytes_per_sample(format);
+    uint8_t *header = writer->buffer;
+    memcpy(header, "RIFF", 4);
+    put_uint32(header + RIFF_SIZE_OFFSET, 0);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    put_uint32(header + 16, 16);
+    put_uint16(header + 20, format == WAV_FLOAT32 ? 3 : 1); // ieee float or pcm
+    put_uint16(header + 22, NUMBER_OF_CHANNELS);
+    put_uint32(header + 24, SAMPLE_RATE);
+    put_uint32(header + 28, SAMPLE_RATE * NUMBER_OF_CHANNELS * sample_size);
+    put_uint16(header + 32, NUMBER_OF_CHANNELS * sample_size);
+    put_uint16(header + 34, sample_size * 8);
+    memcpy(header + 36, "data", 4);
+    put_uint32(header + DATA_SIZE_OFFSET, 0);
+    writer->buffer_size = WAV_HEADER_SIZE;
+    return true;
+}
+
+bool write_wav_frames(WavWriter *writer, const float *samples, uint32_t frames_count) {
+    int sample_size = bytes_per_sample(writer->format);
+    float scale = full_scale(writer->format);
+    uint64_t samples_count = (uint64_t) frames_count * NUMBER_OF_CHANNELS;
+    writer->data_size += samples_count * sample_size;
+
+    while (samples_count > 0 && !writer->did_fail) {
+        uint32_t count = fmin(samples_count, (WAV_WRITE_BUFFER_SIZE - writer->buffer_size) / sample_size);
+        if (count < WAV_DITHER_LANES && count < samples_count) {
+            flush_wav_writer(writer);
+            continue;
+        }
+
+        uint8_t *output = writer->buffer + writer->buffer_size;
+        if (writer->format == WAV_FLOAT32) {
+            memcpy(output, samples, (size_t) count * sizeof(float));
+        } else {
+            convert_kernel(output, samples, count, writer->dither_state, scale, sample_size);
+        }
+        writer->buffer_size += count * sample_size;
+        samples += count;
+        samples_count -= count;
+    }
+    return !writer->did_fail;
+}
+
+bool close_wav_writer(WavWriter *writer) {
+    flush_wav_writer(writer);
+
+    // riff sizes are 32 bit, longer files get the largest size and most players read them to the end
+    uint64_t data_size = writer->data_size;
+    uint8_t sizes[8];
+    put_uint32(sizes, fmin(data_size + WAV_HEADER_SIZE - 8, UINT32_MAX));
+    put_uint32(sizes + 4, fmin(data_size, UINT32_MAX));
+    if (pwrite(writer->file, sizes, 4, RIFF_SIZE_OFFSET) != 4)  writer->did_fail = true;
+    if (pwrite(writer->file, sizes + 4, 4, DATA_SIZE_OFFSET) != 4)  writer->did_fail = true;
+
+    if (close(writer->file) != 0)  writer->did_fail = true;
+    free(writer->buffer);
+    writer->buffer = NULL;
+    return !writer->did_fail;
+}
+
+void save_notes_wave_file(const float *samples, uint32_t frames_count, WavFormat format, const char *filename) {
+    WavWriter writer;
+    if (!open_wav_writer(&writer, filename, format))  return;
+
+    write_wav_frames(&writer, samples, frames_count);
+    if (!close_wav_writer(&writer)) {
+        printf("Error writing file %s.\n", filename);
+        return;
+    }
+
+    printf("Samples exported: %u\n", frames_count);
+    printf("Sample rate: %d\n", SAMPLE_RATE);
+    printf("Channels: %d\n", NUMBER_OF_CHANNELS);
+    printf("Sample format: %s\n", wav_format_name(format));
+}
+
+const char *wav_format_name(WavFormat format) {
+    switch (format) {
+        case WAV_FLOAT32:  return "f32";
+        case WAV_PCM16:    return "16";
+        case WAV_PCM24:    return "24";
+        default:           return "unknown";
+    }
 }
@@ -1,3 +1,44 @@
+#ifndef WAV_INCLUDES
+#define WAV_INCLUDES
+
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "shared.h"
 
-void save_notes_wave_file(void* samples, int samples_count, char *filename);
+#define WAV_WRITE_BUFFER_SIZE (1 << 20) // bytes given to the file at a time
+#define WAV_DITHER_LANES      8         // the scalar and avx2 kernels draw dither noise from the same 8 generators
+
+typedef enum {
+    WAV_FLOAT32,
+    WAV_PCM16,
+    WAV_PCM24,
+    WAV_FORMATS_COUNT
+} WavFormat;
+
+// writes a wav file block by block as it's rendered, memory stays the same whatever the length
+// the sizes in the header are only right once the writer is closed
+typedef struct {
+    int file;
+    WavFormat format;
+    uint8_t *buffer; // page aligned, WAV_WRITE_BUFFER_SIZE bytes
+    int buffer_size;
+    uint64_t data_size;
+    uint32_t dither_state[WAV_DITHER_LANES];
+    bool did_fail;
+} WavWriter;
+
+bool open_wav_writer(WavWriter *writer, const char *filename, WavFormat format);
+
+// integer formats get tpdf dither of one least significant bit and are clipped to full scale
+bool write_wav_frames(WavWriter *writer, const float *samples, uint32_t frames_count);
+
+// patches the sizes in the header, false if anything failed to be written
+bool close_wav_writer(WavWriter *writer);
+
+void save_notes_wave_file(const float *samples, uint32_t frames_count, WavFormat format, const char *filename);
+
+const char *wav_format_name(WavFormat format);
+const char *wav_convert_kernel_name(void);
+
+#endif // WAV_INCLUDES